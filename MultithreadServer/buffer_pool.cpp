@@ -0,0 +1,44 @@
+#include "buffer_pool.h"
+#include "log_manager.h"
+#include "memory_manager.h"
+
+BufferPool::BufferPool(size_t buffer_size, size_t buffers_per_chunk)
+    : buffer_size_(buffer_size), in_use_(0) {
+    // Fill whole (huge) pages with buffers rather than leaving the tail unused
+    chunk_size_ = MemoryManager::round_size(buffer_size_ * (buffers_per_chunk ? buffers_per_chunk : 1));
+    buffers_per_chunk_ = chunk_size_ / buffer_size_;
+}
+
+BufferPool::~BufferPool() {
+    for (char* chunk : chunks_) {
+        MemoryManager::deallocate(chunk, chunk_size_);
+    }
+}
+
+char* BufferPool::acquire() {
+    if (free_list_.empty()) {
+        // Carve a whole chunk at once to avoid one allocation per connection
+        char* chunk = (char*)MemoryManager::allocate(chunk_size_);
+        if (!chunk) {
+            LOG_ERR("Failed to grow the buffer pool beyond %zu bytes (buffer size %zu).", allocated_bytes(), buffer_size_);
+            return nullptr;
+        }
+        chunks_.push_back(chunk);
+        for (size_t i = buffers_per_chunk_; i > 0; --i) {
+            free_list_.push_back(chunk + (i - 1) * buffer_size_);
+        }
+        LOG_DEBUG("Buffer pool grown to %zu bytes (buffer size %zu).", allocated_bytes(), buffer_size_);
+    }
+
+    char* buffer = free_list_.back();
+    free_list_.pop_back();
+    ++in_use_;
+    return buffer;
+}
+
+void BufferPool::release(char* buffer) {
+    if (buffer) {
+        free_list_.push_back(buffer);
+        --in_use_;
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <vector>
+
+// Pool of fixed-size buffers shared by all connections. Connections only borrow
+// a buffer while they hold a partial frame or pending output, so idle
+// connections do not own any buffer memory. Not thread safe: it is only used
+// by the network thread.
+class BufferPool {
+public:
+    BufferPool(size_t buffer_size, size_t buffers_per_chunk);
+    ~BufferPool();
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    // Borrow a buffer from the pool, allocating a new chunk if none is free.
+    // nullptr if the pool cannot grow.
+    char* acquire();
+
+    // Return a buffer to the pool
+    void release(char* buffer);
+
+    size_t buffer_size() const { return buffer_size_; }
+    size_t in_use() const { return in_use_; }
+    size_t allocated_bytes() const { return chunks_.size() * chunk_size_; }
+
+private:
+    size_t buffer_size_;          // Size of each buffer
+    size_t buffers_per_chunk_;    // Number of buffers carved from one allocation
+    size_t chunk_size_;           // Bytes per allocation, rounded to the page size in use
+    size_t in_use_;               // Number of buffers currently borrowed
+    std::vector<char*> chunks_;   // Allocated chunks, freed on destruction
+    std::vector<char*> free_list_; // Buffers ready to be borrowed
+};
+
+#endif // BUFFER_POOL_H
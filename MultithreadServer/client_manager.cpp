@@ -1,10 +1,120 @@
 #include "client_manager.h"
 #include "log_manager.h"
+#include "payload.h"
+#include <algorithm>
 #include <cstring>
 #include <sys/socket.h>
 #include <unistd.h>
 
-ClientInfo* ClientManager::add_client(int client_fd, const SocketInfo& socket_info, uint32_t flags, size_t recv_buffer_size, size_t send_buffer_size) {
+char* ClientInfo::acquire_recv_buffer() {
+    if (!recv_buffer) {
+        recv_buffer = recv_pool->acquire();
+    }
+    return recv_buffer;
+}
+
+char* ClientInfo::acquire_send_buffer() {
+    if (!send_buffer) {
+        send_buffer = send_pool->acquire();
+    }
+    return send_buffer;
+}
+
+// Move a buffer's data into a payload of at least `size` bytes
+static char* grow_buffer(char*& buffer, size_t& buffer_size, size_t data_length, Payload*& payload,
+                         BufferPool* pool, size_t size, size_t max_size) {
+    if (size > max_size) {
+        return nullptr;
+    }
+
+    // Grow geometrically so a large frame arriving in pieces is not copied over and over
+    size_t capacity = std::max(size, std::min(2 * buffer_size, max_size));
+    Payload* grown = Payload::create(capacity);
+    if (!grown) {
+        return nullptr;
+    }
+    if (data_length > 0) {
+        std::memcpy(grown->data(), buffer, data_length);
+    }
+
+    if (payload) {
+        payload->release();
+    } else if (buffer) {
+        pool->release(buffer);
+    }
+    payload = grown;
+    buffer = grown->data();
+    buffer_size = capacity;
+    return buffer;
+}
+
+char* ClientInfo::reserve_recv_buffer(size_t size) {
+    if (size <= recv_buffer_size) {
+        return acquire_recv_buffer();
+    }
+    return grow_buffer(recv_buffer, recv_buffer_size, recv_len, recv_payload, recv_pool, size, max_buffer_size);
+}
+
+char* ClientInfo::reserve_send_buffer(size_t size) {
+    if (size <= send_buffer_size) {
+        return acquire_send_buffer();
+    }
+    return grow_buffer(send_buffer, send_buffer_size, send_len, send_payload, send_pool, size, max_buffer_size);
+}
+
+void ClientInfo::drop_held_responses() {
+    for (auto& held : held_responses) {
+        if (held.second.payload) {
+            held.second.payload->release();
+        }
+    }
+    held_responses.clear();
+}
+
+Payload* ClientInfo::take_recv_payload() {
+    Payload* payload = recv_payload;
+    if (payload) {
+        recv_payload = nullptr;
+        recv_buffer = nullptr;
+        recv_buffer_size = recv_pool->buffer_size();
+        recv_len = 0;
+    }
+    return payload;
+}
+
+void ClientInfo::release_recv_buffer() {
+    if (recv_buffer && recv_len == 0) {
+        if (recv_payload) {
+            recv_payload->release();
+            recv_payload = nullptr;
+            recv_buffer_size = recv_pool->buffer_size();
+        } else {
+            recv_pool->release(recv_buffer);
+        }
+        recv_buffer = nullptr;
+    }
+}
+
+void ClientInfo::release_send_buffer() {
+    if (send_buffer && send_len == 0) {
+        if (send_payload) {
+            send_payload->release();
+            send_payload = nullptr;
+            send_buffer_size = send_pool->buffer_size();
+        } else {
+            send_pool->release(send_buffer);
+        }
+        send_buffer = nullptr;
+    }
+}
+
+void ClientManager::init_buffer_pools(size_t recv_buffer_size, size_t send_buffer_size, size_t buffers_per_chunk, size_t max_packet_size) {
+    recv_pool_.reset(new BufferPool(recv_buffer_size, buffers_per_chunk));
+    send_pool_.reset(new BufferPool(send_buffer_size, buffers_per_chunk));
+    max_packet_size_ = max_packet_size;
+}
+
+ClientInfo* ClientManager::add_client(int client_fd, const SocketInfo& socket_info, uint32_t flags) {
     std::lock_guard<std::mutex> lock(clients_mutex_);
 
     // Initialize client information
@@ -15,11 +125,24 @@ ClientInfo* ClientManager::add_client(int client_fd, const SocketInfo& socket_in
     client.pending_close = false;
     client.flag = flags;
 
-    // TODO: Avoid new & delete
-    client.recv_buffer = new char[recv_buffer_size];
-    client.recv_buffer_size = recv_buffer_size;
-    client.send_buffer = new char[send_buffer_size];
-    client.send_buffer_size = send_buffer_size;
+    // Buffers are borrowed from the shared pools only when needed
+    client.recv_buffer = nullptr;
+    client.recv_buffer_size = recv_pool_->buffer_size();
+    client.recv_pool = recv_pool_.get();
+    client.send_buffer = nullptr;
+    client.send_buffer_size = send_pool_->buffer_size();
+    client.send_pool = send_pool_.get();
+    client.recv_payload = nullptr;
+    client.send_payload = nullptr;
+    client.max_buffer_size = std::max(max_packet_size_, std::max(recv_pool_->buffer_size(), send_pool_->buffer_size()));
+    client.lane = 0;
+    client.recv_lane = 0;
+    client.ordered = false;
+    client.module = 0;
+    client.budget = 0;
+    client.generation = 0;
+    client.request_seq = 0;
+    client.response_seq = 0;
 
     // Add the client to the client list
     clients_[client_fd] = client;
@@ -34,8 +157,12 @@ void ClientManager::remove_client(int client_fd, EventDispatcher* dispatcher) {
 
     auto it = clients_.find(client_fd);
     if (it != clients_.end()) {
-        delete[] it->second.recv_buffer;
-        delete[] it->second.send_buffer;
+        // Discard any pending data and hand the buffers back to the pools
+        it->second.recv_len = 0;
+        it->second.send_len = 0;
+        it->second.release_recv_buffer();
+        it->second.release_send_buffer();
+        it->second.drop_held_responses();
 
         clients_.erase(it);
 
@@ -73,7 +200,12 @@ bool ClientManager::send_to_client(int client_fd, const char* data, size_t lengt
         }
 
         // Copy data to the send buffer
-        std::memcpy(client.send_buffer, data, length);
+        char* send_buffer = client.acquire_send_buffer();
+        if (!send_buffer) {
+            LOG_ERR("No send buffer for client fd: %d", client_fd);
+            return false;
+        }
+        std::memcpy(send_buffer, data, length);
         client.send_len = length;
 
         // Attempt to send data
@@ -84,6 +216,7 @@ bool ClientManager::send_to_client(int client_fd, const char* data, size_t lengt
             if (client.send_len > 0) {
                 std::memmove(client.send_buffer, client.send_buffer + bytes_sent, client.send_len);
             }
+            client.release_send_buffer();
             LOG_TRACE("Sent %zd bytes to client, fd: %d", bytes_sent, client_fd);
             return true;
         } else if (bytes_sent == 0) {
@@ -105,3 +238,12 @@ bool ClientManager::send_to_client(int client_fd, const char* data, size_t lengt
 std::unordered_map<int, ClientInfo>& ClientManager::get_all_clients() {
     return clients_;
 }
+
+void ClientManager::log_memory_usage() {
+    std::lock_guard<std::mutex> lock(clients_mutex_);
+
+    size_t pooled_bytes = recv_pool_->allocated_bytes() + send_pool_->allocated_bytes();
+    LOG_INFO("Clients: %zu, idle footprint: %zu bytes/conn, borrowed buffers: %zu recv / %zu send, pooled: %zu bytes",
+             clients_.size(), sizeof(ClientInfo) + sizeof(int) + 2 * sizeof(void*),
+             recv_pool_->in_use(), send_pool_->in_use(), pooled_bytes);
+}
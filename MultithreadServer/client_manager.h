@@ -2,10 +2,16 @@
 #define CLIENT_MANAGER_H
 
 #include <unordered_map>
+#include <map>
 #include <mutex>
+#include <memory>
 #include "socket_info.h"
+#include "ring_queue.h"
+#include "buffer_pool.h"
 #include "event_dispatcher.h"
 
+class Payload;
+
 // Connection flags
 constexpr uint32_t CN_VALID_MASK   = 0x01;
 constexpr uint32_t CN_LISTEN_MASK  = 0x04;
@@ -13,13 +19,36 @@ constexpr uint32_t CN_PIPE_MASK    = 0x08;
 constexpr uint32_t CN_UDP_MASK     = 0x10;
 constexpr uint32_t CN_FINALIZE     = 0x20;
 
+// A response that completed before the responses of earlier requests
+struct HeldResponse {
+    BlockType type;     // Data, Chunk or Final
+    Payload* payload;   // Holds the response data, nullptr if empty
+    size_t offset;      // Response data inside the payload
+    size_t length;
+};
+
 // Represents client connection information, including buffers and connection flags
 struct ClientInfo {
     SocketInfo socket_info;      // Socket-related information (IP, port, etc.)
-    char* recv_buffer;  // Buffer to hold incoming data
-    char* send_buffer;  // Buffer to hold outgoing data
+    char* recv_buffer;  // Buffer to hold incoming data, borrowed only while a partial frame is pending
+    char* send_buffer;  // Buffer to hold outgoing data, borrowed only while output is pending
     size_t recv_buffer_size;
     size_t send_buffer_size;
+    BufferPool* recv_pool;       // Pool the receive buffer is borrowed from
+    BufferPool* send_pool;       // Pool the send buffer is borrowed from
+    Payload* recv_payload;       // Backs the receive buffer while it holds more than a pool buffer
+    Payload* send_payload;       // Backs the send buffer while it holds more than a pool buffer
+    size_t max_buffer_size;      // Largest size a buffer may grow to for an oversized frame
+    uint8_t lane;                // Receive queue lane of the connection's requests, from its bind
+    uint8_t recv_lane;           // Lane the connection's last frame took, the next read is reserved in it
+    bool ordered;                // Requests are processed in arrival order, from its bind
+    uint8_t module;              // Handler module of the connection's bind
+    uint32_t budget;             // Default deadline of the connection's requests in microseconds, 0 for none
+    uint16_t generation;         // Generation of the connection's table slot, stamped on its requests
+    uint64_t request_seq;        // Sequence number stamped on the next request
+    uint64_t response_seq;       // Sequence number of the next response to send
+    std::multimap<uint64_t, HeldResponse> held_responses;  // Responses waiting for earlier ones, by sequence number,
+                                                           // the parts of a streamed one in queue order
     size_t recv_len;             // Length of valid data in receive buffer
     size_t send_len;             // Length of valid data in send buffer
     bool pending_close;          // Flag to mark if the connection should be closed
@@ -30,13 +59,36 @@ struct ClientInfo {
     bool is_tcp() const { return (flag & CN_LISTEN_MASK) && !(flag & CN_UDP_MASK); }
     bool is_finalize() const { return flag & CN_FINALIZE; }
     bool is_valid() const { return flag & CN_VALID_MASK; }
+
+    // Borrow buffers from the shared pools on demand, nullptr if a pool cannot grow
+    char* acquire_recv_buffer();
+    char* acquire_send_buffer();
+
+    // Make the buffers hold at least `size` bytes, keeping their data. Beyond
+    // the pool buffer size they move to a payload; nullptr if `size` is too large
+    // or no memory is left.
+    char* reserve_recv_buffer(size_t size);
+    char* reserve_send_buffer(size_t size);
+
+    // Detach the receive payload so it can be queued, leaving no pending data
+    Payload* take_recv_payload();
+
+    // Return buffers to the shared pools once they hold no data
+    void release_recv_buffer();
+    void release_send_buffer();
+
+    // Drop the responses held for reordering
+    void drop_held_responses();
 };
 
 // Class to manage all client connections
 class ClientManager {
 public:
+    // Create the shared buffer pools connections borrow from
+    void init_buffer_pools(size_t recv_buffer_size, size_t send_buffer_size, size_t buffers_per_chunk, size_t max_packet_size);
+
     // Add a client
-    ClientInfo* add_client(int client_fd, const SocketInfo& socket_info, uint32_t flags, size_t recv_buffer_size, size_t send_buffer_size);
+    ClientInfo* add_client(int client_fd, const SocketInfo& socket_info, uint32_t flags);
 
     // Remove a client
     void remove_client(int client_fd, EventDispatcher* dispatcher);
@@ -50,9 +102,15 @@ public:
     // Get all clients
     std::unordered_map<int, ClientInfo>& get_all_clients();
 
+    // Log the connection count and the memory held by connection buffers
+    void log_memory_usage();
+
 private:
     std::unordered_map<int, ClientInfo> clients_;  // Stores all client connections
     std::mutex clients_mutex_;  // Mutex lock to protect the client map
+    std::unique_ptr<BufferPool> recv_pool_;  // Shared receive buffers
+    std::unique_ptr<BufferPool> send_pool_;  // Shared send buffers
+    size_t max_packet_size_;  // Largest frame a connection may send or receive
 };
 
 #endif // CLIENT_MANAGER_H
@@ -0,0 +1,50 @@
+#include "connection_table.h"
+#include "log_manager.h"
+#include "memory_manager.h"
+#include <new>
+
+ConnectionTable::ConnectionTable(size_t capacity, bool shared)
+    : capacity_(capacity), shared_(shared) {
+    slots_ = (ConnectionSlot*)MemoryManager::allocate(capacity_ * sizeof(ConnectionSlot), shared_);
+    if (!slots_) {
+        LOG_CRIT("Failed to allocate a connection table of %zu slots.", capacity_);
+        capacity_ = 0;
+        return;
+    }
+    for (size_t i = 0; i < capacity_; ++i) {
+        ConnectionSlot& slot = *new (&slots_[i]) ConnectionSlot();
+        slot.inflight = 0;
+        slot.ordered = true;
+        slot.generation = 0;
+        slot.dropped = 0;
+        slot.socket_info = SocketInfo();
+    }
+    LOG_INFO("Initialize connection table with %zu slots, shared: %d.", capacity_, shared_);
+}
+
+ConnectionTable::~ConnectionTable() {
+    if (slots_) {
+        MemoryManager::deallocate(slots_, capacity_ * sizeof(ConnectionSlot));
+    }
+}
+
+uint16_t ConnectionTable::open(const SocketInfo& socket_info, bool ordered, uint8_t module) {
+    ConnectionSlot* slot = get(socket_info.sock_fd);
+    if (!slot) {
+        LOG_WARN("fd %d exceeds the connection table capacity %zu.", socket_info.sock_fd, capacity_);
+        return 0;
+    }
+    slot->inflight.store(0, std::memory_order_relaxed);
+    slot->ordered.store(ordered, std::memory_order_relaxed);
+    slot->dropped.store(0, std::memory_order_relaxed);
+    slot->module = module;
+    slot->socket_info = socket_info;
+    return slot->generation.fetch_add(1, std::memory_order_release) + 1;
+}
+
+void ConnectionTable::close(int fd) {
+    ConnectionSlot* slot = get(fd);
+    if (slot) {
+        slot->generation.fetch_add(1, std::memory_order_release);
+    }
+}
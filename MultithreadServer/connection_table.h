@@ -0,0 +1,86 @@
+#ifndef CONNECTION_TABLE_H
+#define CONNECTION_TABLE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "socket_info.h"
+
+// Per-connection state shared between the network thread and the workers
+struct ConnectionSlot {
+    std::atomic<uint8_t> inflight;  // Set while a worker is processing a request of this connection
+    std::atomic<bool> ordered;      // Requests must be processed one at a time, in arrival order
+    std::atomic<uint16_t> generation; // Bumped every time the fd is opened or closed
+    std::atomic<uint32_t> dropped;  // 1 + generation of the connection a worker lost a response of, 0 for none
+    uint8_t module;                 // Handler module of the connection's bind, written when it is opened
+    SocketInfo socket_info;         // Metadata of the connection, written when it is opened
+};
+
+// Fixed table of connection slots indexed by socket fd, so workers can look
+// up a connection without locking the client map. A shared table is visible
+// to the worker processes forked after its construction.
+class ConnectionTable {
+public:
+    ConnectionTable(size_t capacity, bool shared);
+    ~ConnectionTable();
+
+    ConnectionTable(const ConnectionTable&) = delete;
+    ConnectionTable& operator=(const ConnectionTable&) = delete;
+
+    // Get the slot of a connection, nullptr if the fd is out of range
+    ConnectionSlot* get(int fd) {
+        return (fd >= 0 && (size_t)fd < capacity_) ? &slots_[fd] : nullptr;
+    }
+
+    // Reset the slot of a newly accepted connection, returns its new generation
+    uint16_t open(const SocketInfo& socket_info, bool ordered, uint8_t module);
+
+    // Mark a connection closed, so the blocks still queued for it are stale
+    void close(int fd);
+
+    // Whether a block stamped with `generation` still belongs to the open connection on `fd`
+    bool is_current(int fd, uint16_t generation) {
+        ConnectionSlot* slot = get(fd);
+        return slot && slot->generation.load(std::memory_order_acquire) == generation;
+    }
+
+    // Record that a response of the connection opened as `generation` could not be queued.
+    // Its later responses would wait for it forever, the network thread closes the connection.
+    void drop_response(int fd, uint16_t generation) {
+        ConnectionSlot* slot = get(fd);
+        // A response to a connection closed meanwhile is not waited for
+        if (slot && slot->generation.load(std::memory_order_acquire) == generation) {
+            slot->dropped.store((uint32_t)generation + 1, std::memory_order_release);
+        }
+    }
+
+    // Whether a response of the connection opened as `generation` was lost
+    bool response_dropped(int fd, uint16_t generation) {
+        ConnectionSlot* slot = get(fd);
+        return slot && slot->dropped.load(std::memory_order_acquire) == (uint32_t)generation + 1;
+    }
+
+    // Metadata of a connection for the handler, nullptr if the fd is out of range
+    const SocketInfo* socket_info(int fd) {
+        ConnectionSlot* slot = get(fd);
+        return slot ? &slot->socket_info : nullptr;
+    }
+
+    // Handler module serving a connection
+    uint8_t module(int fd) {
+        ConnectionSlot* slot = get(fd);
+        return slot ? slot->module : 0;
+    }
+
+    size_t capacity() const { return capacity_; }
+    // False if the slots could not be allocated
+    bool valid() const { return slots_ != nullptr; }
+
+private:
+    ConnectionSlot* slots_;
+    size_t capacity_;
+    bool shared_;
+};
+
+#endif // CONNECTION_TABLE_H
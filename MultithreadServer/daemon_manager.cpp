@@ -9,6 +9,7 @@
 
 volatile int stop_signal = 0;
 volatile int restart_signal = 0;
+volatile int reload_signal = 0;
 
 static void handle_stop_signal(int signo) {
     stop_signal = 1;
@@ -20,6 +21,17 @@ static void handle_restart_signal(int signo) {
     stop_signal = 1;
 }
 
+static void handle_reload_signal(int /* signo */) {
+    reload_signal = 1;
+}
+
+void watch_reload_signal() {
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_reload_signal;
+    sigaction(SIGUSR1, &sa, nullptr);
+}
+
 int start_daemon(int argc, char** argv) {
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -4,4 +4,8 @@
 int start_daemon(int argc, char** argv);
 void stop_daemon();
 
+// SIGUSR1 sets reload_signal, asking the main loop to reload the handler library
+extern volatile int reload_signal;
+void watch_reload_signal();
+
 #endif // DAEMON_MANAGER_H
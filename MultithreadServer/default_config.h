@@ -13,14 +13,42 @@ constexpr int DEFAULT_LOG_SIZE = 104857600;          // Maximum size of each log
 constexpr int DEFAULT_LOG_DEST = 3;
 
 // Server Configuration
-constexpr int DEFAULT_RINGQUEUE_LENGTH = 8192000;    // Length of ring queue buffer
+constexpr int DEFAULT_RINGQUEUE_LENGTH = 8192000;    // Maximum length of a ring queue
+constexpr int DEFAULT_RINGQUEUE_SEGMENT = 262144;    // Queue memory is mapped in segments of this size, 0 maps it all up front
 constexpr int DEFAULT_WORKER_NUM = 4;                // Number of worker threads
+constexpr char DEFAULT_WORKER_MODE[] = "thread";     // Workers as "thread"s or as "process"es sharing the queues
+constexpr char DEFAULT_DISPATCH_MODE[] = "shared";   // "shared" queue, per-worker "affinity" queues or "stealing"
+constexpr int DEFAULT_STEAL_BATCH = 8;               // Maximum blocks a worker steals from a peer at once
+constexpr int DEFAULT_QUEUE_LANES = 1;               // Priority lanes of each receive queue
+constexpr char DEFAULT_LANE_WEIGHTS[] = "";          // Comma separated share of each lane, missing weights are 1
+constexpr int DEFAULT_QUEUE_SPIN = 200;              // Empty checks an idle worker spins before yielding
+constexpr int DEFAULT_QUEUE_YIELD = 8;               // Empty checks an idle worker yields before parking
+constexpr int DEFAULT_QUEUE_BATCH = 32;              // Maximum blocks popped from a queue at once
+constexpr int DEFAULT_TASK_BATCH = 32;               // Maximum handler tasks a worker runs between batches of requests
+constexpr int DEFAULT_QUEUE_BATCH_BUFFER = 65536;    // Bytes popped from a queue at once
+constexpr int DEFAULT_CODEL_TARGET = 0;              // Milliseconds of queue delay above which requests are shed, 0 disables
+constexpr int DEFAULT_CODEL_INTERVAL = 100;          // Milliseconds the delay may stay above the target before shedding
+constexpr int DEFAULT_PKG_TIMEOUT = 0;                // Seconds a client waits for a response, later requests are skipped, 0 disables
+constexpr int DEFAULT_MAX_HELD_RESPONSES = 1024;    // Responses of one connection waiting for an earlier one before it is closed
+constexpr int DEFAULT_MAX_CONNECTIONS = 65536;       // Connection table size when RLIMIT_NOFILE is unlimited
 constexpr char DEFAULT_BIND_FILE[] = "./conf/bind.txt"; // Path to bind configuration file
 
+// Memory Configuration
+constexpr int DEFAULT_HUGE_PAGES = 0;                // 0: regular pages, 1: transparent, 2: explicit huge pages
+constexpr int DEFAULT_MEM_PREFAULT = 0;              // Fault queue and buffer memory in at startup
+constexpr int DEFAULT_MEM_LOCK = 0;                  // mlock queue and buffer memory
+
 // Network Configuration
 constexpr int DEFAULT_RECV_BUFFER_SIZE = 8196;       // Default size for receive buffers
 constexpr int DEFAULT_SEND_BUFFER_SIZE = 8196;       // Default size for send buffers
 constexpr int DEFAULT_MAX_PACKET_SIZE = 8196;        // Maximum packet size to be handled
+constexpr int DEFAULT_READ_SIZE = 8196;              // Bytes read from a socket at once
+constexpr int DEFAULT_INLINE_PAYLOAD = 8196;         // Larger messages are queued by reference to a Payload
+constexpr int DEFAULT_OUTPUT_CHUNK = 65536;          // Size of the pooled chunks handlers stream responses into
+constexpr int DEFAULT_OUTPUT_CHUNK_POOL = 256;       // Idle output chunks kept for reuse
+constexpr int DEFAULT_OUTPUT_WAIT_MS = 5000;         // Longest a streaming handler waits for room in the send queue
+constexpr int DEFAULT_BUFFER_POOL_CHUNK = 64;        // Connection buffers allocated together when the pool grows
+constexpr int DEFAULT_STATS_INTERVAL = 60;           // Seconds between connection memory reports
 
 // Daemon Configuration
 constexpr char DEFAULT_RUN_MODE[] = "foreground";    // Default run mode (foreground or background)
@@ -7,7 +7,66 @@
 #define LOAD_FUNCTION(handle, func, symbol) \
     func = (decltype(func))dlsym(handle, symbol)
 
+#ifdef STATIC_HANDLER
+// Optional entry points, null unless the linked handler defines them
+extern "C" {
+__attribute__((weak)) int handle_init(int argc, char** argv, int thread_type);
+__attribute__((weak)) int handle_input_priority(const char* frame, int frame_len, const SocketInfo* si);
+__attribute__((weak)) int handle_input_deadline(const char* frame, int frame_len, const SocketInfo* si);
+__attribute__((weak)) int handle_message_batch(batch_message_t* messages, int count);
+__attribute__((weak)) int handle_overload(const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
+__attribute__((weak)) int handle_client_open(char** send_buffer, int* send_buffer_len, const SocketInfo* si);
+__attribute__((weak)) int handle_client_close(const SocketInfo* si);
+__attribute__((weak)) int handle_timer(int* milliseconds);
+__attribute__((weak)) void handle_fini(int thread_type);
+__attribute__((weak)) int handle_thread_init(int argc, char** argv, handler_thread_t* thread);
+__attribute__((weak)) int handle_message_batch_context(handler_thread_t* thread, batch_message_t* messages, int count);
+__attribute__((weak)) void handle_thread_fini(handler_thread_t* thread);
+}
+
+// The linked handler's functions, resolved by the linker instead of dlsym()
+static void link_static_functions(dll_func_t* dll_functions) {
+    *dll_functions = dll_func_t();
+    dll_functions->handle_init = handle_init;
+    dll_functions->handle_input_from_client = handle_input_from_client;
+    dll_functions->handle_input_priority = handle_input_priority;
+    dll_functions->handle_input_deadline = handle_input_deadline;
+    dll_functions->handle_message_from_client = handle_message_from_client;
+    dll_functions->handle_message_batch = handle_message_batch;
+    dll_functions->handle_overload = handle_overload;
+    dll_functions->handle_client_open = handle_client_open;
+    dll_functions->handle_client_close = handle_client_close;
+    dll_functions->handle_timer = handle_timer;
+    dll_functions->handle_fini = handle_fini;
+    dll_functions->handle_thread_init = handle_thread_init;
+    dll_functions->handle_input_context = handle_input_context;
+    dll_functions->handle_message_context = handle_message_context;
+    dll_functions->handle_message_batch_context = handle_message_batch_context;
+    dll_functions->handle_thread_fini = handle_thread_fini;
+}
+#endif
+
+// Check for mandatory interfaces, either variant of each will do
+static bool has_mandatory_functions(const dll_func_t* dll_functions) {
+    if (!dll_functions->handle_input_from_client && !dll_functions->handle_input_context) {
+        LOG_ERR("handle_input_from_client not implemented!");
+        return false;
+    }
+    if (!dll_functions->handle_message_from_client && !dll_functions->handle_message_context) {
+        LOG_ERR("handle_message_from_client not implemented!");
+        return false;
+    }
+    return true;
+}
+
 bool load_dll_functions(dll_func_t* dll_functions, const char* dll_path) {
+#ifdef STATIC_HANDLER
+    if (dll_path[0] == '\0') {
+        link_static_functions(dll_functions);
+        return has_mandatory_functions(dll_functions);
+    }
+#endif
+
     // Load the shared library
     dll_functions->handle = dlopen(dll_path, RTLD_NOW);
     if (!dll_functions->handle) {
@@ -18,20 +77,22 @@ bool load_dll_functions(dll_func_t* dll_functions, const char* dll_path) {
     // Load each function
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_init, "handle_init");
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_input_from_client, "handle_input_from_client");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_input_priority, "handle_input_priority");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_input_deadline, "handle_input_deadline");
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_message_from_client, "handle_message_from_client");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_message_batch, "handle_message_batch");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_overload, "handle_overload");
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_client_open, "handle_client_open");
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_client_close, "handle_client_close");
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_timer, "handle_timer");
     LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_fini, "handle_fini");
-    
-    // Check for mandatory interfaces
-    if (! dll_functions->handle_input_from_client) {
-        LOG_ERR("handle_input_from_client not implemented!");
-        unload_dll_functions(dll_functions);
-        return false;
-    }
-    if (! dll_functions->handle_message_from_client) {
-        LOG_ERR("handle_message_from_client not implemented!");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_thread_init, "handle_thread_init");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_input_context, "handle_input_context");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_message_context, "handle_message_context");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_message_batch_context, "handle_message_batch_context");
+    LOAD_FUNCTION(dll_functions->handle, dll_functions->handle_thread_fini, "handle_thread_fini");
+
+    if (!has_mandatory_functions(dll_functions)) {
         unload_dll_functions(dll_functions);
         return false;
     }
@@ -1,27 +1,99 @@
 #ifndef DLL_FUNCTIONS_H
 #define DLL_FUNCTIONS_H
 
-#include "socket_info.h"
+#include "handler_api.h"
 
 // Structure for holding DLL function pointers
 typedef struct dll_func_struct {
     void* handle;
     int (*handle_init)(int argc, char** argv, int thread_type);
     int (*handle_input_from_client)(const char* available_data, int available_data_len, const SocketInfo* si);
+    int (*handle_input_priority)(const char* frame, int frame_len, const SocketInfo* si);
+    int (*handle_input_deadline)(const char* frame, int frame_len, const SocketInfo* si);
     int (*handle_input_from_server)(const char* available_data, int available_data_len, int fd);
     int (*handle_message_from_client)(const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
+    int (*handle_message_batch)(batch_message_t* messages, int count);
+    int (*handle_overload)(const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
     int (*handle_message_from_server)(const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
     int (*handle_client_open)(char** send_buffer, int* send_buffer_len, const SocketInfo* si);
     int (*handle_client_close)(const SocketInfo* si);
     int (*handle_server_close)(int fd);
     int (*handle_timer)(int* milliseconds);
     void (*handle_fini)(int thread_type);
+    // Context variants, preferred over the plain entry points when exported
+    int (*handle_thread_init)(int argc, char** argv, handler_thread_t* thread);
+    int (*handle_input_context)(handler_thread_t* thread, const char* available_data, int available_data_len, const SocketInfo* si);
+    int (*handle_message_context)(handler_thread_t* thread, const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
+    int (*handle_message_batch_context)(handler_thread_t* thread, batch_message_t* messages, int count);
+    void (*handle_thread_fini)(handler_thread_t* thread);
 } dll_func_t;
 
-// Loads the shared library and assigns function pointers
+// Loads the shared library and assigns function pointers. A static build
+// assigns the functions of the linked handler for an empty `dll_path`.
 bool load_dll_functions(dll_func_t* dll_functions, const char* dll_path);
 
 // Unloads the shared library
 void unload_dll_functions(dll_func_t* dll_functions);
 
+#ifdef STATIC_HANDLER
+// Entry points of the handler linked into the binary that are called directly.
+// Weak, a handler implements either the plain or the context variant.
+extern "C" {
+__attribute__((weak)) int handle_input_from_client(const char* available_data, int available_data_len, const SocketInfo* si);
+__attribute__((weak)) int handle_input_context(handler_thread_t* thread, const char* available_data, int available_data_len, const SocketInfo* si);
+__attribute__((weak)) int handle_message_from_client(const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
+__attribute__((weak)) int handle_message_context(handler_thread_t* thread, const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si);
+}
+#endif
+
+// Run the framing handler of `functions` for `thread`. A static build calls the
+// linked handler directly, so link-time optimisation can inline it into the receive loop.
+inline int call_input_from_client(const dll_func_t* functions, handler_thread_t* thread, const char* available_data, int available_data_len, const SocketInfo* si) {
+    if (functions->handle_input_context) {
+#ifdef STATIC_HANDLER
+        if (functions->handle_input_context == &handle_input_context) {
+            return handle_input_context(thread, available_data, available_data_len, si);
+        }
+#endif
+        return functions->handle_input_context(thread, available_data, available_data_len, si);
+    }
+#ifdef STATIC_HANDLER
+    if (functions->handle_input_from_client == &handle_input_from_client) {
+        return handle_input_from_client(available_data, available_data_len, si);
+    }
+#endif
+    return functions->handle_input_from_client(available_data, available_data_len, si);
+}
+
+// Run the message handler of `functions` for `thread`, called directly in a static build as above
+inline int call_message_from_client(const dll_func_t* functions, handler_thread_t* thread, const char* recvc_data, int recvc_data_len, char** send_data, int* send_data_len, const SocketInfo* si) {
+    if (functions->handle_message_context) {
+#ifdef STATIC_HANDLER
+        if (functions->handle_message_context == &handle_message_context) {
+            return handle_message_context(thread, recvc_data, recvc_data_len, send_data, send_data_len, si);
+        }
+#endif
+        return functions->handle_message_context(thread, recvc_data, recvc_data_len, send_data, send_data_len, si);
+    }
+#ifdef STATIC_HANDLER
+    if (functions->handle_message_from_client == &handle_message_from_client) {
+        return handle_message_from_client(recvc_data, recvc_data_len, send_data, send_data_len, si);
+    }
+#endif
+    return functions->handle_message_from_client(recvc_data, recvc_data_len, send_data, send_data_len, si);
+}
+
+// Whether `functions` processes popped requests together
+inline bool has_message_batch(const dll_func_t* functions) {
+    return functions->handle_message_batch || functions->handle_message_batch_context;
+}
+
+// Run the batch handler of `functions` for `thread`
+inline int call_message_batch(const dll_func_t* functions, handler_thread_t* thread, batch_message_t* messages, int count) {
+    if (functions->handle_message_batch_context) {
+        return functions->handle_message_batch_context(thread, messages, count);
+    }
+    return functions->handle_message_batch(messages, count);
+}
+
 #endif // DLL_FUNCTIONS_H
@@ -0,0 +1,39 @@
+#ifndef HANDLER_API_H
+#define HANDLER_API_H
+
+#include <cstdint>
+#include "socket_info.h"
+
+// Types passed between the server and its handlers. The server includes them
+// through dll_functions.h and handlers through TestHandler/server_api.h, so a
+// handler linked into the server sees the same definitions as the server.
+
+// Returned by a message handler that answers later through server_reply()
+constexpr int HANDLER_DEFERRED = 1;
+
+// Identifies a request whose response was deferred
+typedef struct request_handle_struct {
+    uint32_t connection;        // Socket fd of the connection
+    uint32_t sequence;          // Request number on the connection
+    uint16_t generation;        // Connection generation, a reply to a closed connection is dropped
+} request_handle_t;
+
+// One request of a batch handed to handle_message_batch
+typedef struct batch_message_struct {
+    const char* recv_data;      // Request frame
+    int recv_data_len;
+    const SocketInfo* si;       // Connection the request arrived on
+    char* send_data;            // Response space of DEFAULT_INLINE_PAYLOAD (8196) or recv_data_len bytes, whichever is larger, or set to the handler's own memory
+    int send_data_len;          // Response length, 0 for no response
+    int result;                 // Negative closes the connection, as from handle_message_from_client
+    request_handle_t handle;    // Passed to server_reply when the result is HANDLER_DEFERRED
+} batch_message_t;
+
+// The thread a handler callback runs on, passed to the context entry points
+typedef struct handler_thread_struct {
+    void* context;              // Set by handle_thread_init, owned by the handler until handle_thread_fini
+    int thread_type;            // ThreadType of the thread
+    int worker_id;              // Number of the worker, -1 for the main and network threads
+} handler_thread_t;
+
+#endif // HANDLER_API_H
@@ -0,0 +1,184 @@
+#include "handler_registry.h"
+#include "log_manager.h"
+#include "memory_manager.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+HandlerRegistry::HandlerRegistry(const dll_func_t& initial, const std::string& path)
+    : reload_(nullptr), path_(path), latest_(new HandlerVersion()), failed_(0), argc_(0), argv_(nullptr) {
+    latest_->functions = initial;
+    latest_->generation = 0;
+    latest_->refs = 1;
+}
+
+HandlerRegistry::~HandlerRegistry() {
+    // Loaded versions stay mapped until exit, threads the handler started may still run their code
+    if (reload_) {
+        MemoryManager::deallocate(reload_, sizeof(HandlerReload));
+    }
+}
+
+bool HandlerRegistry::init(bool shared) {
+    reload_ = (HandlerReload*)MemoryManager::allocate(sizeof(HandlerReload), shared);
+    if (!reload_) {
+        return false;
+    }
+    reload_->generation = 0;
+    reload_->paths[0][0] = '\0';
+    reload_->paths[1][0] = '\0';
+    return true;
+}
+
+bool HandlerRegistry::reload(const char* path) {
+    if (strlen(path) >= PATH_MAX) {
+        LOG_ERR("Handler path too long: %s", path);
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t generation = reload_->generation.load(std::memory_order_relaxed) + 1;
+    HandlerVersion* version = load(path, generation);
+    if (!version) {
+        LOG_ERR("Handler reload from %s failed, keep generation %u.", path, generation - 1);
+        return false;
+    }
+    HandlerVersion* old = latest_;
+    latest_ = version;
+    path_ = path;
+    strcpy(reload_->paths[generation & 1], path);
+    reload_->generation.store(generation, std::memory_order_release);
+    release(old);
+    LOG_INFO("Handler generation %u loaded from %s.", generation, path);
+    return true;
+}
+
+void HandlerRegistry::attach(HandlerSlot& slot) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    add_ref(latest_);
+    slot.version = latest_;
+    slot.seen = latest_->generation;
+}
+
+void HandlerRegistry::detach(HandlerSlot& slot) {
+    if (slot.version) {
+        release(slot.version);
+        slot.version = nullptr;
+    }
+}
+
+bool HandlerRegistry::init_thread(HandlerSlot& slot) {
+    dll_func_t* functions = slot.functions();
+    slot.thread.context = nullptr;
+    if (functions->handle_thread_init) {
+        return functions->handle_thread_init(argc_, argv_, &slot.thread) == 0;
+    }
+    return !functions->handle_init || functions->handle_init(argc_, argv_, slot.thread.thread_type) == 0;
+}
+
+void HandlerRegistry::fini_thread(HandlerSlot& slot) {
+    dll_func_t* functions = slot.functions();
+    if (functions->handle_thread_fini) {
+        functions->handle_thread_fini(&slot.thread);
+    } else if (functions->handle_fini) {
+        functions->handle_fini(slot.thread.thread_type);
+    }
+    slot.thread.context = nullptr;
+}
+
+dll_func_t* HandlerRegistry::switch_version(HandlerSlot& slot) {
+    slot.seen = reload_->generation.load(std::memory_order_acquire);
+    HandlerVersion* version = acquire_latest();
+    if (!version || version == slot.version) {
+        if (version) {
+            release(version);
+        }
+        return slot.functions();
+    }
+
+    // The new version sets up its state and context for this thread before it gets any work
+    HandlerSlot next = slot;
+    next.version = version;
+    if (!init_thread(next)) {
+        LOG_ERR("Handler generation %u handle_init failed on thread type %d, keep generation %u.",
+                version->generation, slot.thread.thread_type, slot.version->generation);
+        release(version);
+        return slot.functions();
+    }
+    fini_thread(slot);
+    LOG_INFO("Thread type %d moved from handler generation %u to %u.", slot.thread.thread_type, slot.version->generation, version->generation);
+    release(slot.version);
+    slot = next;
+    return slot.functions();
+}
+
+HandlerVersion* HandlerRegistry::acquire_latest() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    uint32_t generation = reload_->generation.load(std::memory_order_acquire);
+    if (latest_->generation != generation) {
+        // A worker process loads the library the server process reloaded
+        if (generation == failed_) {
+            return nullptr;
+        }
+        char path[PATH_MAX];
+        memcpy(path, reload_->paths[generation & 1], sizeof(path));
+        path[PATH_MAX - 1] = '\0';
+        if (reload_->generation.load(std::memory_order_acquire) != generation) {
+            return nullptr;  // Reloaded again meanwhile, the next refresh picks that up
+        }
+        HandlerVersion* version = load(path, generation);
+        if (!version) {
+            LOG_ERR("Handler generation %u failed to load from %s, keep generation %u.", generation, path, latest_->generation);
+            failed_ = generation;
+            return nullptr;
+        }
+        release(latest_);
+        latest_ = version;
+    }
+    add_ref(latest_);
+    return latest_;
+}
+
+void HandlerRegistry::release(HandlerVersion* version) {
+    if (version->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        LOG_INFO("Handler generation %u unloaded.", version->generation);
+        unload_dll_functions(&version->functions);
+        delete version;
+    }
+}
+
+HandlerVersion* HandlerRegistry::load(const char* path, uint32_t generation) {
+    // dlopen() returns the loaded library again for a path it knows, load a private copy instead
+    char copy_path[] = "/tmp/handler_XXXXXX";
+    int copy_fd = mkstemp(copy_path);
+    if (copy_fd < 0) {
+        LOG_ERR("Failed to create a copy of handler %s.", path);
+        return nullptr;
+    }
+    int source_fd = open(path, O_RDONLY);
+    bool copied = source_fd >= 0;
+    char buffer[65536];
+    ssize_t length;
+    while (copied && (length = read(source_fd, buffer, sizeof(buffer))) != 0) {
+        copied = length > 0 && write(copy_fd, buffer, length) == length;
+    }
+    if (source_fd >= 0) {
+        close(source_fd);
+    }
+    close(copy_fd);
+
+    HandlerVersion* version = nullptr;
+    dll_func_t functions;
+    if (!copied) {
+        LOG_ERR("Failed to read handler %s.", path);
+    } else if (load_dll_functions(&functions, copy_path)) {
+        version = new HandlerVersion();
+        version->functions = functions;
+        version->generation = generation;
+        version->refs = 1;
+    }
+    // The mapping keeps the library alive
+    unlink(copy_path);
+    return version;
+}
@@ -0,0 +1,109 @@
+#ifndef HANDLER_REGISTRY_H
+#define HANDLER_REGISTRY_H
+
+#include <atomic>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "dll_functions.h"
+
+// Handler libraries one server may host, the default one and those named in the bind file
+constexpr size_t MAX_HANDLER_MODULES = 8;
+
+// A loaded version of the handler library. Every thread running it holds a
+// reference, as does every task posted from it and every request it deferred,
+// and the library is closed with the last one.
+struct HandlerVersion {
+    dll_func_t functions;
+    uint32_t generation;        // Reload that loaded it, 0 for the library loaded at startup
+    std::atomic<int> refs;
+};
+
+// The version a thread runs
+struct HandlerSlot {
+    HandlerVersion* version = nullptr;
+    uint32_t seen = 0;          // Last reload generation the thread acted on
+    handler_thread_t thread = {nullptr, 0, -1};  // The thread and the context the version gave it
+
+    dll_func_t* functions() const { return &version->functions; }
+};
+
+// Reload request, shared with the worker processes. The path of a generation
+// is written before its bump, alternating slots so a reader is not torn by the next reload.
+struct HandlerReload {
+    std::atomic<uint32_t> generation;
+    char paths[2][PATH_MAX];
+};
+
+// Versions of the handler library in this process. A reload loads the new
+// library next to the running one and bumps a generation the other threads and
+// the worker processes poll between batches. Each thread then runs the new
+// version's handle_init for its type, the old version's handle_fini, and moves
+// over; requests a thread already started finish on the old code. The old
+// library is closed when its last thread moved over, so connections stay open
+// and no thread ever waits for another.
+// A handler running threads of its own must stop them in handle_fini.
+class HandlerRegistry {
+public:
+    // Take over the library loaded at startup from `path`
+    HandlerRegistry(const dll_func_t& initial, const std::string& path);
+    ~HandlerRegistry();
+
+    HandlerRegistry(const HandlerRegistry&) = delete;
+    HandlerRegistry& operator=(const HandlerRegistry&) = delete;
+
+    // Allocate the reload request, `shared` with the worker processes forked afterwards
+    bool init(bool shared);
+    // Arguments passed to handle_init of a new version
+    void set_args(int argc, char** argv) {
+        argc_ = argc;
+        argv_ = argv;
+    }
+
+    // Load the library at `path` and switch every thread to it. The running
+    // version stays if it does not load. The file is loaded from a private copy,
+    // so a library replaced at the same path loads as a new version.
+    bool reload(const char* path);
+    // Library the latest version was loaded from
+    const std::string& path() const { return path_; }
+
+    // Start the calling thread on the latest version, its handle_init is run by the caller
+    void attach(HandlerSlot& slot);
+    // Drop the thread's version, after the caller ran its handle_fini
+    void detach(HandlerSlot& slot);
+    // Switch the thread to the latest version if a reload happened since the last call,
+    // returns the functions it runs
+    dll_func_t* refresh(HandlerSlot& slot) {
+        if (reload_->generation.load(std::memory_order_acquire) == slot.seen) {
+            return slot.functions();
+        }
+        return switch_version(slot);
+    }
+
+    // Run the slot version's handle_thread_init, or handle_init, for the slot's thread
+    bool init_thread(HandlerSlot& slot);
+    // Run the slot version's handle_thread_fini, or handle_fini, which drops the thread's context
+    static void fini_thread(HandlerSlot& slot);
+
+    static void add_ref(HandlerVersion* version) { version->refs.fetch_add(1, std::memory_order_relaxed); }
+    // Drop one reference, the library is closed with the last one
+    static void release(HandlerVersion* version);
+
+private:
+    HandlerReload* reload_;
+    std::string path_;
+    std::mutex mutex_;
+    HandlerVersion* latest_;    // Newest version loaded in this process, holds one reference
+    uint32_t failed_;           // Generation this process failed to load, not retried
+    int argc_;
+    char** argv_;
+
+    dll_func_t* switch_version(HandlerSlot& slot);
+    // Reference to the version of the current generation, loading it in a worker process. nullptr on failure.
+    HandlerVersion* acquire_latest();
+    static HandlerVersion* load(const char* path, uint32_t generation);
+};
+
+#endif // HANDLER_REGISTRY_H
@@ -7,6 +7,7 @@
 #include "dll_functions.h"
 #include "utility.h"
 #include "default_config.h"
+#include "memory_manager.h"
 
 extern volatile int stop_signal;
 LogManager* g_log_manager;
@@ -17,13 +18,21 @@ void print_usage() {
     std::cout << "Options:\n";
     std::cout << "  -h                   Show this help message\n";
     std::cout << "  config_file_path      Path to the configuration file (default: ./config.ini)\n";
-    std::cout << "  dll_file_path         Path to the DLL file (default: ./libhandler.so)\n";
+#ifdef STATIC_HANDLER
+    std::cout << "  dll_file_path         Path to a DLL file served instead of the linked handler, reloaded on SIGUSR1\n";
+#else
+    std::cout << "  dll_file_path         Path to the DLL file (default: ./libhandler.so), reloaded on SIGUSR1\n";
+#endif
 }
 
 int main(int argc, char** argv) {
     // Default file paths
     std::string config_file = "./config.ini";
+#ifdef STATIC_HANDLER
+    std::string dll_file;  // Empty for the handler linked into the binary
+#else
     std::string dll_file = "./libhandler.so";
+#endif
 
     // Parse command-line arguments
     if (argc > 1) {
@@ -62,6 +71,11 @@ int main(int argc, char** argv) {
                                    (LogDestination) ConfigurationManager::getInstance().get_integer("log_dest", DEFAULT_LOG_DEST)
     );
 
+    // Set how ring queues and buffer arenas are backed before anything is allocated
+    MemoryManager::init((HugePageMode) ConfigurationManager::getInstance().get_integer("huge_pages", DEFAULT_HUGE_PAGES),
+                        ConfigurationManager::getInstance().get_integer("mem_prefault", DEFAULT_MEM_PREFAULT) != 0,
+                        ConfigurationManager::getInstance().get_integer("mem_lock", DEFAULT_MEM_LOCK) != 0);
+
     // Load the DLL functions
     dll_func_t dll_functions;
     if (!load_dll_functions(&dll_functions, dll_file.c_str())) {
@@ -69,16 +83,20 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // A SIGUSR1 while the workers start is kept for the main loop instead of killing the process
+    watch_reload_signal();
+
     // Start the server
     Server server(ConfigurationManager::getInstance().get_integer("ringqueue_length", DEFAULT_RINGQUEUE_LENGTH),
-                  ConfigurationManager::getInstance().get_integer("worker_num", DEFAULT_WORKER_NUM), &dll_functions);
+                  ConfigurationManager::getInstance().get_integer("worker_num", DEFAULT_WORKER_NUM), &dll_functions, dll_file);
     server.save_argc_argv(argc, argv);
     if (server.start(ConfigurationManager::getInstance().get_string("bind_file", DEFAULT_BIND_FILE)) != 0) {
         LOG_ERR("Server start failed! Current dir: %s", Utility::getCwd().c_str());
         return 1;
     }
     
-    if (dll_functions.handle_init && dll_functions.handle_init(argc, argv, (int) ThreadType::MAIN) != 0) {
+    // The main thread runs every handler module, reloaded on SIGUSR1
+    if (!server.attach_handlers(ThreadType::MAIN)) {
         LOG_ERR("Main thread handle_init failed.");
         return 1;
     }
@@ -87,11 +105,15 @@ int main(int argc, char** argv) {
     int timer_interval_ms = 1000;
     while (!stop_signal) {
         std::this_thread::sleep_for(std::chrono::milliseconds(timer_interval_ms));
+        if (reload_signal) {
+            reload_signal = 0;
+            server.reload_handlers();
+        }
+        server.refresh_handlers();
+
         auto now = std::chrono::steady_clock::now();
         int elapsed_time = static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(now - last_timer_call).count());
-        if (dll_functions.handle_timer) {
-            dll_functions.handle_timer(&elapsed_time);
-        }
+        server.run_handler_timers(elapsed_time);
         last_timer_call = now;
     }
 
@@ -99,9 +121,7 @@ int main(int argc, char** argv) {
     server.stop();
     stop_daemon();
     
-    if (dll_functions.handle_fini) {
-        dll_functions.handle_fini((int) ThreadType::MAIN);
-    }
+    server.detach_handlers();
 
     return 0;
 }
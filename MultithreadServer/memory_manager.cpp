@@ -0,0 +1,129 @@
+#include "memory_manager.h"
+#include "log_manager.h"
+#include <chrono>
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifndef MAP_ANONYMOUS
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
+constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+HugePageMode MemoryManager::mode_ = HugePageMode::None;
+bool MemoryManager::prefault_ = false;
+bool MemoryManager::lock_ = false;
+
+void MemoryManager::init(HugePageMode mode, bool prefault, bool lock) {
+    mode_ = mode;
+    prefault_ = prefault;
+    lock_ = lock;
+    LOG_INFO("Memory policy: huge pages %d, prefault %d, lock %d.", (int)mode_, prefault_, lock_);
+}
+
+size_t MemoryManager::round_size(size_t size) {
+    size_t align = (mode_ == HugePageMode::None) ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+    return (size + align - 1) / align * align;
+}
+
+// Map anonymous memory aligned to a huge page boundary so THP can back it
+static void* map_aligned(size_t size, int visibility) {
+    size_t map_size = size + HUGE_PAGE_SIZE;
+    char* raw = (char*)mmap(nullptr, map_size, PROT_READ | PROT_WRITE, visibility | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return nullptr;
+    }
+
+    char* aligned = (char*)(((uintptr_t)raw + HUGE_PAGE_SIZE - 1) & ~(uintptr_t)(HUGE_PAGE_SIZE - 1));
+    if (aligned > raw) {
+        munmap(raw, aligned - raw);
+    }
+    size_t tail = (raw + map_size) - (aligned + size);
+    if (tail > 0) {
+        munmap(aligned + size, tail);
+    }
+    return aligned;
+}
+
+void* MemoryManager::allocate(size_t size, bool shared) {
+    auto start_time = std::chrono::steady_clock::now();
+    size_t alloc_size = round_size(size);
+    int visibility = shared ? MAP_SHARED : MAP_PRIVATE;
+    void* ptr = nullptr;
+    bool populated = false;
+
+#ifdef __linux__
+    if (mode_ == HugePageMode::Explicit) {
+        int flags = visibility | MAP_ANONYMOUS | MAP_HUGETLB | (prefault_ ? MAP_POPULATE : 0);
+        ptr = mmap(nullptr, alloc_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            LOG_WARN("Explicit huge pages unavailable for %zu bytes, falling back to transparent huge pages.", alloc_size);
+            ptr = nullptr;
+        } else {
+            populated = prefault_;
+        }
+    }
+#endif
+
+    if (!ptr && mode_ != HugePageMode::None) {
+        ptr = map_aligned(alloc_size, visibility);
+#ifdef MADV_HUGEPAGE
+        if (ptr && madvise(ptr, alloc_size, MADV_HUGEPAGE) != 0) {
+            LOG_WARN("madvise(MADV_HUGEPAGE) failed for %zu bytes.", alloc_size);
+        }
+#endif
+    }
+
+    // Regular pages, also when no huge page mapping could be made
+    if (!ptr) {
+        if (mode_ != HugePageMode::None) {
+            LOG_WARN("Huge pages unavailable for %zu bytes, falling back to regular pages.", alloc_size);
+        }
+        int flags = visibility | MAP_ANONYMOUS;
+#ifdef MAP_POPULATE
+        if (prefault_) {
+            flags |= MAP_POPULATE;
+            populated = true;
+        }
+#endif
+        ptr = mmap(nullptr, alloc_size, PROT_READ | PROT_WRITE, flags, -1, 0);
+        if (ptr == MAP_FAILED) {
+            ptr = nullptr;
+        }
+    }
+
+    if (!ptr) {
+        LOG_CRIT("Failed to allocate %zu bytes.", alloc_size);
+        return nullptr;
+    }
+
+    // Touch every page so THP mappings are faulted in now rather than on first use
+    if (prefault_ && !populated) {
+        size_t step = (mode_ == HugePageMode::None) ? (size_t)sysconf(_SC_PAGESIZE) : HUGE_PAGE_SIZE;
+        for (size_t offset = 0; offset < alloc_size; offset += step) {
+            ((volatile char*)ptr)[offset] = 0;
+        }
+    }
+
+    if (lock_ && mlock(ptr, alloc_size) != 0) {
+        LOG_WARN("mlock failed for %zu bytes, check RLIMIT_MEMLOCK.", alloc_size);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start_time);
+    LOG_DEBUG("Allocated %zu bytes in %lld us (huge pages %d, prefault %d, lock %d, shared %d).",
+              alloc_size, (long long)elapsed.count(), (int)mode_, prefault_, lock_, shared);
+    return ptr;
+}
+
+void MemoryManager::deallocate(void* ptr, size_t size) {
+    if (ptr) {
+        munmap(ptr, round_size(size));
+    }
+}
+
+void MemoryManager::discard(void* ptr, size_t size) {
+    if (ptr && !lock_ && madvise(ptr, round_size(size), MADV_DONTNEED) != 0) {
+        LOG_WARN("madvise(MADV_DONTNEED) failed for %zu bytes.", round_size(size));
+    }
+}
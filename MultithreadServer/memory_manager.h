@@ -0,0 +1,41 @@
+#ifndef MEMORY_MANAGER_H
+#define MEMORY_MANAGER_H
+
+#include <cstddef>
+
+// Backing used for large long-lived allocations (ring queues, buffer arenas)
+enum class HugePageMode {
+    None = 0,         // Regular pages
+    Transparent = 1,  // Transparent huge pages via madvise
+    Explicit = 2      // Explicit huge pages from the hugetlbfs pool
+};
+
+// Allocates the large memory regions of the server, optionally backed by huge
+// pages, pre-faulted and locked so the first traffic burst does not pay for
+// page faults and TLB misses.
+class MemoryManager {
+public:
+    // Set the allocation policy, must be called before any region is allocated
+    static void init(HugePageMode mode, bool prefault, bool lock);
+
+    // Allocate a region of at least `size` bytes, returns nullptr on failure.
+    // A shared region stays shared with the processes forked afterwards.
+    static void* allocate(size_t size, bool shared = false);
+
+    // Release a region returned by allocate() with the same size
+    static void deallocate(void* ptr, size_t size);
+
+    // Give the pages of a private region back to the system but keep it mapped,
+    // it reads as zeros until written again. Locked regions are left alone.
+    static void discard(void* ptr, size_t size);
+
+    // Size actually reserved for a request of `size` bytes
+    static size_t round_size(size_t size);
+
+private:
+    static HugePageMode mode_;
+    static bool prefault_;
+    static bool lock_;
+};
+
+#endif // MEMORY_MANAGER_H
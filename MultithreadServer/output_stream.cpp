@@ -0,0 +1,168 @@
+#include "output_stream.h"
+#include "default_config.h"
+#include "server.h"
+#include "log_manager.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <thread>
+
+// Wait until the send queue has room for a block, the network thread drains it meanwhile
+static bool wait_for_space(RingQueue& queue, size_t length, const QueueBlock& block_header) {
+    auto give_up = std::chrono::steady_clock::now() + std::chrono::milliseconds(DEFAULT_OUTPUT_WAIT_MS);
+    while (!queue.has_space(length, block_header)) {
+        if (std::chrono::steady_clock::now() >= give_up) {
+            LOG_ERR("Send queue stayed full, drop the output of client fd: %u", block_header.connection);
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+bool push_output(RingQueue& queue, const QueueBlock& block_header, Payload* payload, size_t offset, size_t length, bool last) {
+    QueueBlock header = block_header;
+    if (length == 0) {
+        // Nothing to reference, an empty last part still completes the response
+        header.type = BlockType::Data;
+        header.total_length = sizeof(QueueBlock);
+        return !last || (wait_for_space(queue, 0, header) && queue.push(nullptr, 0, header));
+    }
+    if (!queue.is_shared()) {
+        // One block referencing the payload, a last one is resolved as Indirect
+        header.type = last ? BlockType::Data : BlockType::Chunk;
+        if (!wait_for_space(queue, sizeof(PayloadRef), header)) {
+            return false;
+        }
+        payload->add_ref();
+        return push_payload(queue, payload, offset, length, header);
+    }
+
+    // A payload pointer means nothing to another process, copy the bytes into the queue
+    do {
+        size_t piece = std::min(length, (size_t)DEFAULT_OUTPUT_CHUNK);
+        header.type = last && piece == length ? BlockType::Data : BlockType::Chunk;
+        header.total_length = piece + sizeof(QueueBlock);
+        if (!wait_for_space(queue, piece, header) ||
+            !queue.push(payload->data() + offset, piece, header)) {
+            return false;
+        }
+        offset += piece;
+        length -= piece;
+    } while (length > 0);
+    return true;
+}
+
+OutputStream::OutputStream(RingQueue& send_queue)
+    : send_queue_(send_queue), responses_(nullptr), active_(false), used_(false), failed_(false), chunk_(nullptr), written_(0), flushed_(0) {
+}
+
+OutputStream::~OutputStream() {
+    if (chunk_) {
+        chunk_->release();
+    }
+}
+
+void OutputStream::begin(const QueueBlock& block, ResponseBatch& responses) {
+    responses_ = &responses;
+    header_ = block;
+    header_.lane = 0;
+    header_.budget = 0;
+    active_ = true;
+    used_ = false;
+    failed_ = false;
+}
+
+char* OutputStream::reserve(size_t min_length, size_t& available) {
+    available = 0;
+    if (!active_ || failed_ || min_length > (size_t)DEFAULT_OUTPUT_CHUNK) {
+        return nullptr;
+    }
+
+    if (chunk_ && chunk_->capacity() - written_ < std::max(min_length, (size_t)1)) {
+        // The chunk is full, hand it to the send path and continue in a fresh one
+        if (!push_pending(false)) {
+            return nullptr;
+        }
+        retire_chunk();
+    }
+    if (!chunk_) {
+        chunk_ = Payload::create_chunk();
+        if (!chunk_) {
+            return nullptr;
+        }
+        written_ = 0;
+        flushed_ = 0;
+    }
+    available = chunk_->capacity() - written_;
+    return chunk_->data() + written_;
+}
+
+bool OutputStream::commit(size_t length) {
+    if (!active_ || failed_ || !chunk_ || length > chunk_->capacity() - written_) {
+        return false;
+    }
+    written_ += length;
+    used_ = true;
+    return true;
+}
+
+bool OutputStream::write(const char* data, size_t length) {
+    while (length > 0) {
+        size_t available = 0;
+        char* space = reserve(1, available);
+        if (!space) {
+            return false;
+        }
+        size_t piece = std::min(length, available);
+        std::memcpy(space, data, piece);
+        commit(piece);
+        data += piece;
+        length -= piece;
+    }
+    return active_ && !failed_;
+}
+
+bool OutputStream::flush() {
+    if (!active_ || failed_) {
+        return false;
+    }
+    used_ = true;
+    return push_pending(false);
+}
+
+bool OutputStream::finish(bool last) {
+    bool queued = !failed_ && push_pending(last);
+    active_ = false;
+    retire_chunk();
+    return queued;
+}
+
+void OutputStream::retire_chunk() {
+    // Queued parts of a private queue still reference the chunk, a shared queue copied them
+    if (chunk_ && flushed_ > 0 && !send_queue_.is_shared()) {
+        chunk_->release();
+        chunk_ = nullptr;
+    }
+    written_ = 0;
+    flushed_ = 0;
+}
+
+bool OutputStream::push_pending(bool last) {
+    size_t pending = written_ - flushed_;
+    if (!used_ && pending == 0) {
+        // Nothing was streamed, the request is answered as usual
+        return true;
+    }
+    // Send the batched responses of earlier requests first, the network thread would hold the parts until then
+    if (responses_) {
+        responses_->flush();
+        responses_ = nullptr;
+    }
+    if (!push_output(send_queue_, header_, chunk_, flushed_, pending, last)) {
+        failed_ = true;
+        return false;
+    }
+    flushed_ = written_;
+    return true;
+}
@@ -0,0 +1,69 @@
+#ifndef OUTPUT_STREAM_H
+#define OUTPUT_STREAM_H
+
+#include <cstddef>
+#include "ring_queue.h"
+#include "payload.h"
+
+class ResponseBatch;
+
+// Queue `length` bytes of `payload` at `offset` as the response parts of a
+// request: Chunk blocks, followed by a Data block if `last` is set. A private
+// queue carries them by reference, a shared queue inline in pieces of at most
+// DEFAULT_OUTPUT_CHUNK bytes. Waits while the send queue is full, for at most
+// DEFAULT_OUTPUT_WAIT_MS. The caller keeps its reference to the payload.
+bool push_output(RingQueue& queue, const QueueBlock& block_header, Payload* payload, size_t offset, size_t length, bool last);
+
+// Streamed output of the request a worker is processing. The handler appends
+// to pooled chunks of DEFAULT_OUTPUT_CHUNK bytes instead of a fixed response
+// buffer: a full chunk is queued as a Chunk block and a fresh one taken, so a
+// response of any size reaches the socket without being copied again. The
+// network thread sends the parts as they arrive, in request order.
+class OutputStream {
+public:
+    explicit OutputStream(RingQueue& send_queue);
+    ~OutputStream();
+
+    OutputStream(const OutputStream&) = delete;
+    OutputStream& operator=(const OutputStream&) = delete;
+
+    // Start the output of the request in `block`, the worker's batched responses
+    // are pushed before its first part
+    void begin(const QueueBlock& block, ResponseBatch& responses);
+    // Return true between begin() and finish()
+    bool active() const { return active_; }
+    // Return true if the handler wrote or flushed anything
+    bool used() const { return used_; }
+
+    // Writable space of at least `min_length` bytes, `available` receives its size.
+    // nullptr if no request is current or `min_length` exceeds a chunk.
+    char* reserve(size_t min_length, size_t& available);
+    // Append the first `length` bytes of the last reservation
+    bool commit(size_t length);
+    // Append a copy of `data`
+    bool write(const char* data, size_t length);
+    // Queue what was appended so far, so the network thread can send it
+    bool flush();
+
+    // End the request's output. With `last` the remaining bytes complete the
+    // response, otherwise they are queued as a part and a response follows.
+    bool finish(bool last);
+
+private:
+    RingQueue& send_queue_;
+    ResponseBatch* responses_;  // Worker's batch, until it was flushed for this request
+    bool active_;
+    bool used_;
+    bool failed_;         // A part could not be queued, the rest of the output is dropped
+    Payload* chunk_;      // Chunk being filled, nullptr until the first write
+    size_t written_;      // Bytes appended to the chunk
+    size_t flushed_;      // Bytes of them already queued
+    QueueBlock header_;   // Identifies the request the parts answer, last for its flexible array
+
+    // Queue the appended bytes not queued yet
+    bool push_pending(bool last);
+    // Start over with an empty chunk
+    void retire_chunk();
+};
+
+#endif // OUTPUT_STREAM_H
@@ -0,0 +1,77 @@
+#include "payload.h"
+#include "log_manager.h"
+#include "default_config.h"
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Output chunks are taken by the workers and dropped by the network thread once sent
+static std::mutex chunk_pool_mutex;
+static std::vector<Payload*> chunk_pool;
+
+Payload* Payload::create(size_t capacity) {
+    void* memory = ::operator new(sizeof(Payload) + capacity, std::nothrow);
+    if (!memory) {
+        LOG_ERR("Failed to allocate payload of %zu bytes.", capacity);
+        return nullptr;
+    }
+    return new (memory) Payload(capacity, false);
+}
+
+Payload* Payload::create_chunk() {
+    {
+        std::lock_guard<std::mutex> lock(chunk_pool_mutex);
+        if (!chunk_pool.empty()) {
+            Payload* chunk = chunk_pool.back();
+            chunk_pool.pop_back();
+            chunk->refs_.store(1, std::memory_order_relaxed);
+            return chunk;
+        }
+    }
+
+    void* memory = ::operator new(sizeof(Payload) + DEFAULT_OUTPUT_CHUNK, std::nothrow);
+    if (!memory) {
+        LOG_ERR("Failed to allocate output chunk of %d bytes.", DEFAULT_OUTPUT_CHUNK);
+        return nullptr;
+    }
+    return new (memory) Payload(DEFAULT_OUTPUT_CHUNK, true);
+}
+
+void Payload::release() {
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (pooled_) {
+            std::lock_guard<std::mutex> lock(chunk_pool_mutex);
+            if (chunk_pool.size() < (size_t)DEFAULT_OUTPUT_CHUNK_POOL) {
+                chunk_pool.push_back(this);
+                return;
+            }
+        }
+        this->~Payload();
+        ::operator delete(this);
+    }
+}
+
+bool push_payload(RingQueue& queue, Payload* payload, size_t offset, size_t length, const QueueBlock& block_header) {
+    PayloadRef ref;
+    ref.payload = payload;
+    ref.offset = offset;
+    ref.length = length;
+
+    // A streamed Chunk keeps its type, the network thread resolves it like an Indirect block
+    QueueBlock header = block_header;
+    if (header.type != BlockType::Chunk) {
+        header.type = BlockType::Indirect;
+    }
+    if (!queue.push((const char*)&ref, sizeof(ref), header)) {
+        payload->release();
+        return false;
+    }
+    return true;
+}
+
+PayloadRef payload_ref(const char* block_data) {
+    PayloadRef ref;
+    std::memcpy(&ref, block_data, sizeof(ref));
+    return ref;
+}
@@ -0,0 +1,60 @@
+#ifndef PAYLOAD_H
+#define PAYLOAD_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include "ring_queue.h"
+
+// Refcounted message body kept outside the ring queues. Frames larger than
+// DEFAULT_INLINE_PAYLOAD are queued as a small Indirect block carrying a
+// PayloadRef, and whoever drops the last reference frees the payload.
+class Payload {
+public:
+    // Allocate a payload of `capacity` bytes holding one reference, nullptr on failure
+    static Payload* create(size_t capacity);
+
+    // Take a payload of DEFAULT_OUTPUT_CHUNK bytes from the chunk pool, it goes
+    // back to the pool with its last reference
+    static Payload* create_chunk();
+
+    void add_ref() { refs_.fetch_add(1, std::memory_order_relaxed); }
+
+    // Drop one reference, the payload is freed with the last one
+    void release();
+
+    char* data() { return data_; }
+    size_t capacity() const { return capacity_; }
+
+    // Return true if [ptr, ptr + length) lies inside the payload
+    bool contains(const char* ptr, size_t length) const {
+        return ptr >= data_ && ptr + length <= data_ + capacity_;
+    }
+
+private:
+    Payload(size_t capacity, bool pooled) : refs_(1), pooled_(pooled), capacity_(capacity) {}
+
+    std::atomic<uint32_t> refs_;
+    bool pooled_;       // Returned to the chunk pool instead of freed
+    size_t capacity_;
+    char data_[];
+};
+
+// Data part of an Indirect queue block
+struct PayloadRef {
+    Payload* payload;  // Referenced payload, one reference is owned by the block
+    size_t offset;     // Start of the message inside the payload
+    size_t length;     // Message length
+
+    const char* data() const { return payload->data() + offset; }
+};
+
+// Queue `length` bytes of `payload` at `offset` as an Indirect block, or as a
+// Chunk block if the header says so. The block takes over one reference, which
+// is dropped here if the push fails.
+bool push_payload(RingQueue& queue, Payload* payload, size_t offset, size_t length, const QueueBlock& block_header);
+
+// Read the reference carried by an Indirect block
+PayloadRef payload_ref(const char* block_data);
+
+#endif // PAYLOAD_H
@@ -1,11 +1,17 @@
 #include "protocol_handler.h"
 #include "tcp_handler.h"
 #include "udp_handler.h"
+#include "payload.h"
+#include "default_config.h"
+#include <algorithm>
+#include <cstring>
 
 // Singleton instances of TCP and UDP handlers
 static TcpHandler tcp_handler_instance;
 static UdpHandler udp_handler_instance;
 
+CopyStats* ProtocolHandler::copy_stats_ = nullptr;
+
 // Factory method for TCP handler
 ProtocolHandler* ProtocolHandler::get_tcp_handler() {
     return &tcp_handler_instance;
@@ -15,3 +21,204 @@ ProtocolHandler* ProtocolHandler::get_tcp_handler() {
 ProtocolHandler* ProtocolHandler::get_udp_handler() {
     return &udp_handler_instance;
 }
+
+void ProtocolHandler::set_copy_stats(CopyStats* stats) {
+    copy_stats_ = stats;
+}
+
+void ProtocolHandler::count_request_copy(size_t length) {
+    if (copy_stats_) {
+        copy_stats_->count_request_copy(length);
+    }
+}
+
+void ProtocolHandler::count_response_copy(size_t length) {
+    if (copy_stats_) {
+        copy_stats_->count_response_copy(length);
+    }
+}
+
+char* ProtocolHandler::reserve_receive(ClientInfo& client, RingQueue& recv_queue, QueueReservation& reservation, char* buffer) {
+    if (client.recv_len == 0 && recv_queue.reserve(DEFAULT_READ_SIZE, client.recv_lane, reservation)) {
+        return reservation.data;
+    }
+    reservation.data = nullptr;
+    return buffer;
+}
+
+ssize_t ProtocolHandler::queue_received(ClientInfo& client, dll_func_t* dll_functions, handler_thread_t* thread, RingQueue& recv_queue,
+                                        QueueReservation& reservation, char* buffer, size_t length) {
+    // The handler is asked once per frame, a framing callback may keep state across calls
+    bool first_framed = false;
+    int first_result = 0;
+    int first_lane = -1;
+    if (reservation.data) {
+        first_result = call_input_from_client(dll_functions, thread, reservation.data, (int)length, &client.socket_info);
+        first_framed = true;
+        if (first_result == (int)length) {
+            first_lane = frame_lane(client, dll_functions, reservation.data, (int)length, recv_queue.lanes());
+        }
+        // The reservation was made in the lane of the connection's last frame, a frame of another lane takes the copy path
+        if (first_result == (int)length && first_lane == (int)reservation.lane) {
+            LOG_TRACE("Received complete packet size %zu in place from client fd: %d", length, client.socket_info.sock_fd);
+            QueueBlock recv_block;
+            recv_block.connection = client.socket_info.sock_fd;
+            recv_block.generation = client.generation;
+            recv_block.timestamp = queue_clock();
+            recv_block.type = BlockType::Data;
+            recv_block.lane = (uint8_t)reservation.lane;
+            recv_block.budget = frame_budget(client, dll_functions, reservation.data, (int)length);
+            recv_block.sequence = (uint32_t)client.request_seq++;
+            recv_queue.commit(reservation, recv_block, length);
+            if (copy_stats_) {
+                copy_stats_->requests.fetch_add(1, std::memory_order_relaxed);
+                copy_stats_->requests_in_place.fetch_add(1, std::memory_order_relaxed);
+            }
+            return 0;
+        }
+
+        // Several or partial frames, split them from the stack buffer instead
+        std::memcpy(buffer, reservation.data, length);
+        count_request_copy(length);
+        recv_queue.cancel(reservation);
+    }
+
+    const char* data = buffer;
+    size_t data_len = length;
+
+    // Only connections with a partial frame pending own a receive buffer
+    if (client.recv_len > 0) {
+        if (!client.reserve_recv_buffer(client.recv_len + length)) {
+            LOG_ERR("Receive buffer overflow for client fd: %d", client.socket_info.sock_fd);
+            return -1;
+        }
+
+        std::memcpy(client.recv_buffer + client.recv_len, buffer, length);
+        count_request_copy(length);
+        client.recv_len += length;
+        data = client.recv_buffer;
+        data_len = client.recv_len;
+    }
+
+    // Process the accumulated data, the complete packets are pushed to the queue together
+    QueueBatch batch(recv_queue);
+    size_t offset = 0;
+    int result = 0;
+    while (offset < data_len &&
+           (result = first_framed ? first_result : call_input_from_client(dll_functions, thread, data + offset, (int)(data_len - offset), &client.socket_info)) > 0) {
+        first_framed = false;
+        LOG_TRACE("Received complete packet size %d from client fd: %d", result, client.socket_info.sock_fd);
+
+        // Push the complete packet to the queue
+        QueueBlock recv_block;
+        recv_block.connection = client.socket_info.sock_fd;
+        recv_block.generation = client.generation;
+        recv_block.timestamp = queue_clock();
+        recv_block.type = BlockType::Data;
+        recv_block.lane = first_lane >= 0 ? (uint8_t)first_lane : frame_lane(client, dll_functions, data + offset, result, recv_queue.lanes());
+        first_lane = -1;
+        recv_block.budget = frame_budget(client, dll_functions, data + offset, result);
+        recv_block.sequence = (uint32_t)client.request_seq++;
+        recv_block.total_length = result + sizeof(QueueBlock);
+
+        if (!queue_frame(client, recv_queue, batch, data + offset, result, recv_block)) {
+            batch.clear();
+            return -1;
+        }
+        if (copy_stats_) {
+            copy_stats_->requests.fetch_add(1, std::memory_order_relaxed);
+        }
+        offset += result;
+    }
+    batch.flush();
+    if (batch.size() > 0) {
+        // The queue is full, the frames left in the batch would leave holes in the connection's requests
+        LOG_ERR("Receive queue full, %zu frames dropped for client fd: %d", batch.size(), client.socket_info.sock_fd);
+        batch.clear();
+        return -1;
+    }
+    if (offset >= data_len) {
+        result = 0;
+    }
+
+    // If `handle_input_from_client` returns 0, it means we're still waiting for more data.
+    if (result == 0) {
+        // Keep the partial frame in a borrowed buffer, or give the buffer back
+        size_t remaining_length = data_len - offset;
+        if (remaining_length > 0 && (data != client.recv_buffer || offset > 0)) {
+            char* pending = client.reserve_recv_buffer(remaining_length);
+            if (!pending) {
+                LOG_ERR("Receive buffer overflow for client fd: %d", client.socket_info.sock_fd);
+                return -1;
+            }
+            std::memmove(pending, data + offset, remaining_length);
+            count_request_copy(remaining_length);
+        }
+        client.recv_len = remaining_length;
+        client.release_recv_buffer();
+        return 0;
+    }
+    // `handle_input_from_client` returned a negative value, indicating an error.
+    LOG_WARN("Handler refused the data, closing connection on fd: %d", client.socket_info.sock_fd);
+    return -1;
+}
+
+bool ProtocolHandler::queue_frame(ClientInfo& client, RingQueue& recv_queue, QueueBatch& batch,
+                                  const char* frame, size_t length, const QueueBlock& block_header) {
+    // Worker processes cannot follow a payload pointer, so a shared queue carries frames inline
+    if (length <= (size_t)DEFAULT_INLINE_PAYLOAD || recv_queue.is_shared()) {
+        // The batch points at the frame, pushing it copies it into the queue
+        if (!batch.add(frame, length, block_header)) {
+            return false;
+        }
+        count_request_copy(length);
+        return true;
+    }
+
+    // Keep the order with the frames already batched
+    batch.flush();
+    if (batch.size() > 0) {
+        return false;
+    }
+    Payload* payload = nullptr;
+    if (frame == client.recv_buffer && length == client.recv_len) {
+        payload = client.take_recv_payload();
+    }
+    if (!payload) {
+        payload = Payload::create(length);
+        if (!payload) {
+            return false;
+        }
+        std::memcpy(payload->data(), frame, length);
+        count_request_copy(length);
+    }
+    LOG_TRACE("Queue frame of %zu bytes out of line for client fd: %d", length, client.socket_info.sock_fd);
+    return push_payload(recv_queue, payload, 0, length, block_header);
+}
+
+uint8_t ProtocolHandler::frame_lane(ClientInfo& client, dll_func_t* dll_functions, const char* frame, int length, size_t lanes) {
+    int lane = client.lane;
+    if (dll_functions->handle_input_priority) {
+        int priority = dll_functions->handle_input_priority(frame, length, &client.socket_info);
+        if (priority >= 0) {
+            lane = priority;
+        }
+    }
+    // Lanes are served independently, so a worker could take an ordered connection's
+    // later request first; its requests share a lane until the earlier ones are answered
+    if (client.ordered && client.request_seq != client.response_seq) {
+        lane = client.recv_lane;
+    }
+    client.recv_lane = (uint8_t)std::min(lane, (int)lanes - 1);
+    return client.recv_lane;
+}
+
+uint32_t ProtocolHandler::frame_budget(const ClientInfo& client, dll_func_t* dll_functions, const char* frame, int length) {
+    if (dll_functions->handle_input_deadline) {
+        int milliseconds = dll_functions->handle_input_deadline(frame, length, &client.socket_info);
+        if (milliseconds >= 0) {
+            return (uint32_t)std::min(milliseconds, MAX_REQUEST_BUDGET_MS) * 1000;
+        }
+    }
+    return client.budget;
+}
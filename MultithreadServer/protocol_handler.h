@@ -6,16 +6,40 @@
 #include "dll_functions.h"
 #include "log_manager.h"
 #include "ring_queue.h"
+#include <atomic>
+
+// Copies of request and response bytes made by the server on their way
+// between the sockets and the handler, in shared memory so worker processes
+// count into it too. Writes by the handler itself are not counted.
+struct CopyStats {
+    std::atomic<uint64_t> requests;           // Frames queued for the workers
+    std::atomic<uint64_t> requests_in_place;  // Of them received straight into the queue
+    std::atomic<uint64_t> request_copies;     // Copies out of a reservation, into a receive buffer or into the queue
+    std::atomic<uint64_t> request_bytes;      // Bytes moved by them
+    std::atomic<uint64_t> responses;          // Responses queued by the workers
+    std::atomic<uint64_t> response_copies;    // Copies into the send queue, a payload or a pending send buffer
+    std::atomic<uint64_t> response_bytes;     // Bytes moved by them
+
+    void count_request_copy(size_t length) {
+        request_copies.fetch_add(1, std::memory_order_relaxed);
+        request_bytes.fetch_add(length, std::memory_order_relaxed);
+    }
+
+    void count_response_copy(size_t length) {
+        response_copies.fetch_add(1, std::memory_order_relaxed);
+        response_bytes.fetch_add(length, std::memory_order_relaxed);
+    }
+};
 
 class ProtocolHandler {
 public:
     virtual ~ProtocolHandler() = default;
 
-    // Method to accept new clients
-    virtual void accept_client(int server_fd, ClientManager& client_manager, EventDispatcher* dispatcher, dll_func_t* dll_functions, size_t recv_buffer_size, size_t send_buffer_size) = 0;
+    // Method to accept new clients, returns the new client or nullptr
+    virtual ClientInfo* accept_client(int server_fd, ClientManager& client_manager, EventDispatcher* dispatcher, dll_func_t* dll_functions) = 0;
 
-    // Method to receive data
-    virtual ssize_t receive_data(ClientInfo& client, dll_func_t* dll_functions, RingQueue& recv_queue) = 0;
+    // Method to receive data, `thread` is passed to the handler's framing callback
+    virtual ssize_t receive_data(ClientInfo& client, dll_func_t* dll_functions, handler_thread_t* thread, RingQueue& recv_queue) = 0;
 
     // Method to send data
     virtual ssize_t send_data(ClientInfo& client, const char* buffer, size_t length) = 0;
@@ -23,6 +47,46 @@ public:
     // Static factory methods to get protocol handlers
     static ProtocolHandler* get_tcp_handler();
     static ProtocolHandler* get_udp_handler();
+
+    // Counters the handlers count their copies into, none by default
+    static void set_copy_stats(CopyStats* stats);
+
+protected:
+    // Space for the next read of up to DEFAULT_READ_SIZE bytes. Without a partial
+    // frame pending it is reserved in the queue, in the lane of the connection's
+    // last frame, so a single complete request reaches the workers without
+    // another copy; `reservation.data` is then set. Otherwise it is `buffer`.
+    static char* reserve_receive(ClientInfo& client, RingQueue& recv_queue, QueueReservation& reservation, char* buffer);
+
+    // Frame `length` bytes received into the space reserve_receive() returned and
+    // queue the complete frames. One frame of the reserved lane filling the read is
+    // committed in place, anything else is copied to `buffer` and split from there,
+    // keeping a partial frame in the connection's receive buffer. Returns 0, or -1
+    // if the handler refused the data or the queue is full.
+    static ssize_t queue_received(ClientInfo& client, dll_func_t* dll_functions, handler_thread_t* thread, RingQueue& recv_queue,
+                                  QueueReservation& reservation, char* buffer, size_t length);
+
+    // Queue one complete frame. Frames larger than DEFAULT_INLINE_PAYLOAD are
+    // queued by reference; a frame filling the connection's payload-backed
+    // receive buffer is handed over without a copy. Returns false if the frame,
+    // or a batched frame before it, could not be queued.
+    static bool queue_frame(ClientInfo& client, RingQueue& recv_queue, QueueBatch& batch,
+                            const char* frame, size_t length, const QueueBlock& block_header);
+
+    // Queue lane of a complete frame, asked from the handler if it exports
+    // handle_input_priority, otherwise the connection's lane. An ordered
+    // connection with requests still unanswered keeps their lane.
+    static uint8_t frame_lane(ClientInfo& client, dll_func_t* dll_functions, const char* frame, int length, size_t lanes);
+
+    // Deadline budget of a complete frame in microseconds, asked from the handler
+    // if it exports handle_input_deadline, otherwise the connection's budget
+    static uint32_t frame_budget(const ClientInfo& client, dll_func_t* dll_functions, const char* frame, int length);
+
+    // Count a copy of `length` request or response bytes
+    static void count_request_copy(size_t length);
+    static void count_response_copy(size_t length);
+
+    static CopyStats* copy_stats_;
 };
 
 #endif // PROTOCOL_HANDLER_H
@@ -0,0 +1,37 @@
+#include "queue_delay.h"
+#include "log_manager.h"
+
+QueueDelayController::QueueDelayController(uint32_t target_us, uint32_t interval_us)
+    : target_(target_us), interval_(interval_us), started_(false), interval_end_(0), min_delay_(UINT32_MAX),
+      overloaded_(false), shed_(0) {
+}
+
+bool QueueDelayController::should_shed(uint32_t sojourn, uint32_t now) {
+    if (!started_) {
+        started_ = true;
+        interval_end_ = now + interval_;
+    }
+    if (sojourn < min_delay_) {
+        min_delay_ = sojourn;
+    }
+
+    // At the end of each window, judge it by its best case
+    if ((int32_t)(now - interval_end_) >= 0) {
+        bool overloaded = min_delay_ > target_;
+        if (overloaded && !overloaded_) {
+            LOG_WARN("Queue delay stayed above %u us for %u us, shedding requests.", target_, interval_);
+        } else if (!overloaded && overloaded_) {
+            LOG_INFO("Queue delay back under %u us after shedding %llu requests.", target_, (unsigned long long)shed_);
+            shed_ = 0;
+        }
+        overloaded_ = overloaded;
+        min_delay_ = UINT32_MAX;
+        interval_end_ = now + interval_;
+    }
+
+    if (overloaded_ && sojourn > 2 * target_) {
+        ++shed_;
+        return true;
+    }
+    return false;
+}
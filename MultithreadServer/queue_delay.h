@@ -0,0 +1,34 @@
+#ifndef QUEUE_DELAY_H
+#define QUEUE_DELAY_H
+
+#include <cstdint>
+
+// CoDel-style load shedder for a request queue. It tracks the smallest queue
+// delay seen in each interval: if even that stayed above the target, the queue
+// holds a standing backlog and the server is overloaded. While overloaded,
+// requests that waited more than twice the target are shed, so the others are
+// served with a short delay instead of every request waiting until it is useless.
+// Bursts shorter than an interval are absorbed. Each worker runs its own
+// controller on the requests it dequeues.
+// Times are queue_clock() microseconds, compared modulo 2^32.
+class QueueDelayController {
+public:
+    // A zero target disables the controller
+    QueueDelayController(uint32_t target_us, uint32_t interval_us);
+
+    bool enabled() const { return target_ > 0; }
+
+    // Return true if a request that waited `sojourn` microseconds should be shed
+    bool should_shed(uint32_t sojourn, uint32_t now);
+
+private:
+    uint32_t target_;           // Acceptable standing queue delay
+    uint32_t interval_;         // Window over which the minimum delay is taken
+    bool started_;              // The first window was opened
+    uint32_t interval_end_;     // End of the current window
+    uint32_t min_delay_;        // Smallest delay seen in the current window
+    bool overloaded_;           // The minimum delay of the last window was above the target
+    uint64_t shed_;             // Requests shed since overload started
+};
+
+#endif // QUEUE_DELAY_H
@@ -1,154 +1,948 @@
 #include "ring_queue.h"
+#include <algorithm>
 #include <cstring>  // for memcpy
-#include <cstdlib>  // for malloc and free
+#include <new>
+#include <cstdint>
+#include <cstddef>
+#include <thread>
 #include "log_manager.h"
+#include "memory_manager.h"
 
-RingQueue::RingQueue(size_t buffer_size)
-    : buffer_size_(buffer_size), padding_enabled_(false) {
-    buffer_ = (char*)malloc(buffer_size_);
-    write_index_ = 0;
-    read_index_ = 0;
-    LOG_INFO("Initialize ring queue size: %d.", buffer_size_);
+#ifdef __linux__
+#include <climits>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+#include <unistd.h>
+
+// Spins before a waiting thread starts yielding its time slice
+constexpr int SPIN_LIMIT = 128;
+
+// Drained segments an elastic queue keeps resident per lane for the next burst
+constexpr size_t QUEUE_WARM_SEGMENTS = 2;
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
 }
 
-RingQueue::~RingQueue() {
-    free(buffer_);
+// Wait until `index` reaches `expected`, used to publish in reservation order
+static inline void wait_for_turn(const std::atomic<size_t>& index, size_t expected) {
+    int spins = 0;
+    while (index.load(std::memory_order_acquire) != expected) {
+        if (++spins < SPIN_LIMIT) {
+            cpu_relax();
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+RingQueue::RingQueue(size_t buffer_size, const std::vector<int>& lane_weights, bool shared, size_t segment_size)
+    : shared_(shared), lane_count_(std::max<size_t>(1, std::min(lane_weights.size(), MAX_QUEUE_LANES))) {
+    // Memory mapped after a fork is not shared, so a shared queue is allocated up front.
+    // Segments are whole (huge) pages.
+    size_t lane_size = buffer_size / lane_count_;
+    segment_size = segment_size > 0 ? MemoryManager::round_size(segment_size) : 0;
+    elastic_ = !shared_ && segment_size > 0 && segment_size < lane_size;
+    segment_size_ = elastic_ ? segment_size : lane_size;
+    // The queued bytes span at most capacity / segment_size + 1 segments, so with
+    // one more slot the slot of a segment being entered has always been passed by read_tail
+    size_t segment_count = elastic_ ? (lane_size + segment_size_ - 1) / segment_size_ + 1 : 1;
+
+    // Everything producers and consumers write lives in one region, shared with forked processes if asked
+    region_size_ = sizeof(QueueControl) + lane_count_ * (sizeof(QueueLane) + segment_count * sizeof(QueueSegment));
+    spin_count_ = 0;
+    yield_count_ = 0;
+    wake_fd_ = -1;
+    pending_work_ = nullptr;
+    lanes_ = nullptr;
+    control_ = nullptr;
+    region_ = shared_ ? (char*)MemoryManager::allocate(region_size_, true) : new char[region_size_];
+    if (!region_) {
+        LOG_ERR("Failed to allocate the %zu byte control region of a ring queue.", region_size_);
+        return;
+    }
+    control_ = new (region_) QueueControl();
+    lanes_ = (QueueLane*)(region_ + sizeof(QueueControl));
+    QueueSegment* segments = (QueueSegment*)(region_ + sizeof(QueueControl) + lane_count_ * sizeof(QueueLane));
+    for (size_t i = 0; i < lane_count_; ++i) {
+        QueueLane& lane = *new (&lanes_[i]) QueueLane();
+        lane.segments = segments + i * segment_count;
+        lane.segment_count = segment_count;
+        lane.segment_size = segment_size_;
+        lane.capacity = lane_size;
+        for (size_t j = 0; j < segment_count; ++j) {
+            QueueSegment& segment = *new (&lane.segments[j]) QueueSegment();
+            segment.number = 0;
+            segment.memory = nullptr;
+        }
+        if (!elastic_) {
+            lane.segments[0].memory = (char*)MemoryManager::allocate(lane_size, shared_);
+            lane.segments[0].number = 1;
+            if (!lane.segments[0].memory) {
+                LOG_ERR("Failed to allocate %zu bytes for lane %zu of a ring queue.", lane_size, i);
+            }
+        }
+        lane.write_head = 0;
+        lane.write_tail = 0;
+        lane.read_head = 0;
+        lane.read_tail = 0;
+    }
+
+    // Spread each lane's turns over the cycle (smooth weighted round robin)
+    std::vector<int> weights(lane_count_, 1);
+    int total_weight = 0;
+    for (size_t i = 0; i < lane_count_ && i < lane_weights.size(); ++i) {
+        weights[i] = std::max(1, lane_weights[i]);
+    }
+    for (int weight : weights) {
+        total_weight += weight;
+    }
+    std::vector<int> current(lane_count_, 0);
+    for (int turn = 0; turn < total_weight; ++turn) {
+        size_t best = 0;
+        for (size_t i = 0; i < lane_count_; ++i) {
+            current[i] += weights[i];
+            if (current[i] > current[best]) {
+                best = i;
+            }
+        }
+        current[best] -= total_weight;
+        schedule_.push_back((uint8_t)best);
+    }
+
+    control_->ticket = 0;
+    control_->wake_seq = 0;
+    control_->waiters = 0;
+    control_->fd_waiting = false;
+    LOG_INFO("Initialize ring queue size: %zu, lanes: %zu, shared: %d, segment size: %zu.",
+             buffer_size, lane_count_, shared_, elastic_ ? segment_size_ : (size_t)0);
 }
 
-// Get the remaining space in the ring queue
-size_t RingQueue::get_free_space() const {
-    size_t current_write = write_index_.load(std::memory_order_acquire);
-    size_t current_read = read_index_.load(std::memory_order_acquire);
-    if (current_write >= current_read) {
-        return buffer_size_ - (current_write - current_read);
+RingQueue::~RingQueue() {
+    if (elastic_) {
+        for (char* memory : all_segments_) {
+            MemoryManager::deallocate(memory, segment_size_);
+        }
+    } else if (lanes_) {
+        for (size_t i = 0; i < lane_count_; ++i) {
+            MemoryManager::deallocate(lanes_[i].segments[0].memory, lanes_[i].segment_size);
+        }
+    }
+    if (shared_) {
+        MemoryManager::deallocate(region_, region_size_);
     } else {
-        return current_read - current_write;
+        delete[] region_;
+    }
+}
+
+bool RingQueue::valid() const {
+    if (!lanes_) {
+        return false;
+    }
+    for (size_t i = 0; i < lane_count_ && !elastic_; ++i) {
+        if (!lanes_[i].segments[0].memory) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Get the remaining space in a lane
+size_t RingQueue::get_free_space(const QueueLane& lane) const {
+    return lane.capacity - (lane.write_head.load(std::memory_order_acquire) - lane.read_tail.load(std::memory_order_acquire));
+}
+
+// Get the used space in a lane
+size_t RingQueue::get_used_space(const QueueLane& lane) const {
+    return lane.write_tail.load(std::memory_order_acquire) - lane.read_head.load(std::memory_order_acquire);
+}
+
+// No lane holds a published block
+bool RingQueue::empty() const {
+    for (size_t i = 0; i < lane_count_; ++i) {
+        if (lanes_[i].write_tail.load(std::memory_order_seq_cst) != lanes_[i].read_head.load(std::memory_order_acquire)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+QueueLane& RingQueue::lane_of(const QueueBlock& block_header) const {
+    return lanes_[std::min<size_t>(block_header.lane, lane_count_ - 1)];
+}
+
+char* RingQueue::writable_at(QueueLane& lane, size_t position) {
+    if (elastic_) {
+        // The producer that entered the segment may still be mapping it
+        size_t number = position / lane.segment_size;
+        wait_for_turn(lane.segments[number % lane.segment_count].number, number + 1);
+    }
+    return lane.block_at(position);
+}
+
+size_t RingQueue::segments_entered(const QueueLane& lane, size_t start, size_t end) const {
+    if (!elastic_) {
+        return 0;
+    }
+    return (end + lane.segment_size - 1) / lane.segment_size - (start + lane.segment_size - 1) / lane.segment_size;
+}
+
+char* RingQueue::take_segment() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    std::vector<char*>& pool = warm_segments_.empty() ? cold_segments_ : warm_segments_;
+    if (!pool.empty()) {
+        char* memory = pool.back();
+        pool.pop_back();
+        return memory;
+    }
+
+    char* memory = (char*)MemoryManager::allocate(segment_size_);
+    if (memory) {
+        all_segments_.push_back(memory);
+        LOG_DEBUG("Ring queue grown to %zu segments of %zu bytes.", all_segments_.size(), segment_size_);
+    }
+    return memory;
+}
+
+void RingQueue::return_segment(char* memory) {
+    {
+        std::lock_guard<std::mutex> lock(pool_mutex_);
+        if (warm_segments_.size() < QUEUE_WARM_SEGMENTS * lane_count_) {
+            warm_segments_.push_back(memory);
+            return;
+        }
+    }
+
+    // Give the pages back but keep the mapping, a stale reader may still look at it
+    MemoryManager::discard(memory, segment_size_);
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    cold_segments_.push_back(memory);
+}
+
+bool RingQueue::prepare_segment(const QueueLane& lane, size_t start, size_t end, char*& segment) {
+    if (!segment && segments_entered(lane, start, end) > 0) {
+        segment = take_segment();
+    }
+    return segment || segments_entered(lane, start, end) == 0;
+}
+
+void RingQueue::finish_segment(QueueLane& lane, size_t start, size_t end, char* segment) {
+    if (segments_entered(lane, start, end) > 0) {
+        install_segment(lane, (start + lane.segment_size - 1) / lane.segment_size, segment);
+    } else if (segment) {
+        return_segment(segment);
+    }
+}
+
+void RingQueue::install_segment(QueueLane& lane, size_t number, char* memory) {
+    QueueSegment& slot = lane.segments[number % lane.segment_count];
+    if (slot.number.load(std::memory_order_acquire) == number + 1) {
+        return_segment(memory);  // Mapped by a reservation that was given back
+        return;
     }
+
+    // The consumer retiring the previous segment of the slot may still be handing it back
+    wait_for_turn(slot.number, 0);
+    slot.memory.store(memory, std::memory_order_relaxed);
+    slot.number.store(number + 1, std::memory_order_release);
+}
+
+void RingQueue::retire_segments(QueueLane& lane, size_t from, size_t to) {
+    for (size_t number = from / lane.segment_size; number < to / lane.segment_size; ++number) {
+        QueueSegment& slot = lane.segments[number % lane.segment_count];
+        char* memory = slot.memory.load(std::memory_order_relaxed);
+        slot.number.store(0, std::memory_order_release);
+        return_segment(memory);
+    }
+}
+
+void RingQueue::copy_in(QueueLane& lane, size_t position, const void* src, size_t length) {
+    std::memcpy(writable_at(lane, position), src, length);
+}
+
+void RingQueue::copy_out(const QueueLane& lane, size_t position, void* dst, size_t length) const {
+    std::memcpy(dst, lane.block_at(position), length);
+}
+
+// The type byte of a header, accessed atomically when releasing
+static inline char* type_of(char* header) {
+    return header + offsetof(QueueBlock, type);
+}
+
+size_t RingQueue::padding_before(const QueueLane& lane, size_t position, size_t total_length) const {
+    size_t room = lane.segment_size - position % lane.segment_size;
+    return room >= total_length ? 0 : room;
+}
+
+void RingQueue::insert_padding_if_needed(QueueLane& lane, size_t position, size_t length) {
+    if (length >= sizeof(QueueBlock)) {
+        QueueBlock header;
+        header.total_length = (uint32_t)length;
+        header.type = BlockType::Padding;
+        copy_in(lane, position, &header, sizeof(QueueBlock));
+    }
+}
+
+bool RingQueue::reserve_space(QueueLane& lane, size_t total_length, size_t& start, size_t& position) {
+    if (total_length > lane.segment_size) {
+        return false;
+    }
+
+    char* segment = nullptr;  // Memory for the segment the reservation enters, if any
+    size_t current_write = lane.write_head.load(std::memory_order_relaxed);
+    size_t padding;
+    do {
+        padding = padding_before(lane, current_write, total_length);
+        size_t free_space = lane.capacity - (current_write - lane.read_tail.load(std::memory_order_acquire));
+        if (free_space < padding + total_length ||
+            !prepare_segment(lane, current_write, current_write + padding + total_length, segment)) {
+            if (segment) {
+                return_segment(segment);
+            }
+            return false;  // Not enough free space
+        }
+    } while (!lane.write_head.compare_exchange_weak(current_write, current_write + padding + total_length,
+                                                    std::memory_order_acq_rel, std::memory_order_relaxed));
+    finish_segment(lane, current_write, current_write + padding + total_length, segment);
+
+    // Skip the tail of the ring if the block would wrap around
+    insert_padding_if_needed(lane, current_write, padding);
+    start = current_write;
+    position = current_write + padding;
+    return true;
+}
+
+void RingQueue::park(uint32_t seq, std::chrono::milliseconds timeout) {
+#ifdef __linux__
+    timespec ts;
+    ts.tv_sec = timeout.count() / 1000;
+    ts.tv_nsec = (timeout.count() % 1000) * 1000000;
+    syscall(SYS_futex, (uint32_t*)&control_->wake_seq, shared_ ? FUTEX_WAIT : FUTEX_WAIT_PRIVATE, seq, &ts, nullptr, 0);
+#else
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_var_.wait_for(lock, timeout, [this, seq] { return control_->wake_seq.load() != seq; });
+#endif
 }
 
-// Get the used space in the queue
-size_t RingQueue::get_used_space() const {
-    size_t current_write = write_index_.load(std::memory_order_acquire);
-    size_t current_read = read_index_.load(std::memory_order_acquire);
-    if (current_write >= current_read) {
-        return current_write - current_read;
+void RingQueue::wake(int count) {
+    if (wake_fd_ >= 0 && control_->fd_waiting.load(std::memory_order_seq_cst) && control_->fd_waiting.exchange(false)) {
+        char signal = 1;
+        if (write(wake_fd_, &signal, 1) < 0) {
+            LOG_TRACE("Wake descriptor %d is full.", wake_fd_);
+        }
+    }
+
+    // Only pay for the syscall when a consumer is actually parked
+    if (control_->waiters.load(std::memory_order_seq_cst) == 0) {
+        return;
+    }
+    control_->wake_seq.fetch_add(1, std::memory_order_seq_cst);
+#ifdef __linux__
+    syscall(SYS_futex, (uint32_t*)&control_->wake_seq, shared_ ? FUTEX_WAKE : FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0);
+#else
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (count == 1) {
+        cond_var_.notify_one();
     } else {
-        return buffer_size_ - (current_read - current_write);
+        cond_var_.notify_all();
     }
+#endif
 }
 
 // Push a data block into the queue
 bool RingQueue::push(const char* data, size_t length, const QueueBlock& block_header) {
-    std::unique_lock<std::mutex> lock(mutex_);
-
+    QueueLane& lane = lane_of(block_header);
     size_t total_length = length + sizeof(QueueBlock);
 
-    if (total_length > buffer_size_) {
-        LOG_ERR("Block size %d exceeds the entire buffer %d.", total_length, buffer_size_);
-        return false;  // Block size exceeds the entire buffer
+    if (total_length > lane.segment_size) {
+        LOG_ERR("Block size %zu exceeds the segment size %zu.", total_length, lane.segment_size);
+        return false;  // Block size exceeds a segment
     }
 
-    size_t current_write = write_index_.load(std::memory_order_acquire);
-    size_t free_space = get_free_space();
-
-    // Check if there is enough free space
-    if (free_space < total_length) {
-        LOG_ERR("Not engouth free space %d < %d.", free_space, total_length);
+    // Reserve space for the block
+    size_t start;
+    size_t position;
+    if (!reserve_space(lane, total_length, start, position)) {
+        // A full queue is the caller's to report, it may happen on every push under load
+        LOG_DEBUG("Not enough free space %zu < %zu.", get_free_space(lane), total_length);
         return false;  // Not enough free space
     }
 
-    // Calculate the current write position
-    size_t write_pos = current_write % buffer_size_;
+    // First, write the header information, then the data
+    QueueBlock header = block_header;
+    header.total_length = (uint32_t)total_length;
+    copy_in(lane, position, &header, sizeof(QueueBlock));
+    if (length > 0) {
+        copy_in(lane, position + sizeof(QueueBlock), data, length);
+    }
+
+    // Publish after every earlier reservation has been published
+    wait_for_turn(lane.write_tail, start);
+    lane.write_tail.store(position + total_length, std::memory_order_seq_cst);
+
+    // Notify waiting consumers that data is available
+    wake(1);
 
-    // Calculate the remaining space at the end of the buffer
-    size_t remaining_space_at_end = buffer_size_ - write_pos;
+    return true;
+}
 
-    if (remaining_space_at_end >= total_length) {
-        // First, write the header information
-        std::memcpy(buffer_ + write_pos, &block_header, sizeof(QueueBlock));
-        // Then write the data
-        if (block_header.total_length > sizeof(QueueBlock)) {
-            std::memcpy(buffer_ + write_pos + sizeof(QueueBlock), data, length);
+// Push several blocks with one reservation and one publish
+size_t RingQueue::push_batch(const QueueBlock* block_headers, const char* const* data, const size_t* lengths, size_t count) {
+    if (count == 0) {
+        return 0;
+    }
+
+    QueueLane& lane = lane_of(block_headers[0]);
+    size_t pushed;
+    size_t batch_end;
+
+    // Reserve space for as many blocks as fit, each one padded to stay contiguous;
+    // a batch enters at most one new segment
+    char* segment = nullptr;
+    size_t current_write = lane.write_head.load(std::memory_order_relaxed);
+    do {
+        size_t free_space = lane.capacity - (current_write - lane.read_tail.load(std::memory_order_acquire));
+        pushed = 0;
+        batch_end = current_write;
+        while (pushed < count) {
+            size_t total_length = lengths[pushed] + sizeof(QueueBlock);
+            size_t block_end = batch_end + padding_before(lane, batch_end, total_length) + total_length;
+            if (total_length > lane.segment_size || block_end - current_write > free_space ||
+                segments_entered(lane, current_write, block_end) > 1) {
+                break;
+            }
+            batch_end = block_end;
+            ++pushed;
         }
-    } else {
-        // The data crosses the end of the buffer, write it in two parts
-        std::memcpy(buffer_ + write_pos, &block_header, remaining_space_at_end);
-        std::memcpy(buffer_, (char*)&block_header + remaining_space_at_end, sizeof(QueueBlock) - remaining_space_at_end);
-        if (block_header.total_length > sizeof(QueueBlock)) {
-            std::memcpy(buffer_, data, length);
+        if (pushed == 0 || !prepare_segment(lane, current_write, batch_end, segment)) {
+            if (segment) {
+                return_segment(segment);
+            }
+            LOG_DEBUG("Not enough free space %zu < %zu.", free_space, lengths[0] + sizeof(QueueBlock));
+            return 0;  // Not enough free space
+        }
+    } while (!lane.write_head.compare_exchange_weak(current_write, batch_end,
+                                                    std::memory_order_acq_rel, std::memory_order_relaxed));
+    finish_segment(lane, current_write, batch_end, segment);
+
+    size_t position = current_write;
+    for (size_t i = 0; i < pushed; ++i) {
+        QueueBlock header = block_headers[i];
+        header.total_length = (uint32_t)(lengths[i] + sizeof(QueueBlock));
+        size_t padding = padding_before(lane, position, header.total_length);
+        insert_padding_if_needed(lane, position, padding);
+        position += padding;
+        copy_in(lane, position, &header, sizeof(QueueBlock));
+        if (lengths[i] > 0) {
+            copy_in(lane, position + sizeof(QueueBlock), data[i], lengths[i]);
         }
+        position += header.total_length;
     }
 
-    // Update the write index
-    write_index_.store(current_write + total_length, std::memory_order_release);
+    // Publish the whole batch at once
+    wait_for_turn(lane.write_tail, current_write);
+    lane.write_tail.store(batch_end, std::memory_order_seq_cst);
+    wake((int)pushed);
 
-    // Notify waiting consumers that data is available
-    cond_var_.notify_one();
+    if (pushed < count) {
+        LOG_DEBUG("Not enough free space, %zu of %zu blocks pushed.", pushed, count);
+    }
+    return pushed;
+}
+
+// Reserve payload space in place
+bool RingQueue::reserve(size_t length, size_t lane, QueueReservation& reservation) {
+    reservation.lane = std::min(lane, lane_count_ - 1);
+    QueueLane& ring = lanes_[reservation.lane];
 
+    // Keep room for a padding header behind the block, so a shorter commit can always close the gap
+    size_t total_length = sizeof(QueueBlock) + length + sizeof(QueueBlock);
+    if (!reserve_space(ring, total_length, reservation.start, reservation.position)) {
+        return false;
+    }
+    reservation.end = reservation.position + total_length;
+    reservation.data = writable_at(ring, reservation.position) + sizeof(QueueBlock);
+    reservation.length = length;
     return true;
 }
 
-// Pop a data block from the queue
-bool RingQueue::wait_and_pop(char* data, size_t max_buffer_size, size_t& actual_length, QueueBlock& block_header, std::chrono::milliseconds timeout) {
-    std::unique_lock<std::mutex> lock(mutex_);
+void RingQueue::finish_reservation(const QueueReservation& reservation, size_t end) {
+    QueueLane& lane = lanes_[reservation.lane];
 
+    // Hand the unused space back if no later reservation was made, otherwise pad it
+    size_t publish_end = reservation.end;
+    size_t give_back = (end == reservation.position) ? reservation.start : end;
+    size_t expected = reservation.end;
+    if (lane.write_head.compare_exchange_strong(expected, give_back, std::memory_order_acq_rel, std::memory_order_relaxed)) {
+        publish_end = give_back;
+    } else {
+        insert_padding_if_needed(lane, end, reservation.end - end);
+    }
+
+    if (publish_end != reservation.start) {
+        // Publish after every earlier reservation has been published
+        wait_for_turn(lane.write_tail, reservation.start);
+        lane.write_tail.store(publish_end, std::memory_order_seq_cst);
+    }
+}
+
+// Publish a block written in place
+void RingQueue::commit(const QueueReservation& reservation, const QueueBlock& block_header, size_t length) {
+    if (length > reservation.length) {
+        LOG_ERR("Commit length %zu exceeds the reservation %zu.", length, reservation.length);
+        length = reservation.length;
+    }
+
+    QueueBlock header = block_header;
+    header.total_length = (uint32_t)(length + sizeof(QueueBlock));
+    header.lane = (uint8_t)reservation.lane;
+    copy_in(lanes_[reservation.lane], reservation.position, &header, sizeof(QueueBlock));
+    finish_reservation(reservation, reservation.position + header.total_length);
+
+    // Notify waiting consumers that data is available
+    wake(1);
+}
+
+// Drop a reservation without publishing a block
+void RingQueue::cancel(const QueueReservation& reservation) {
+    finish_reservation(reservation, reservation.position);
+}
+
+bool RingQueue::next_block(const QueueLane& lane, size_t position, size_t limit, size_t& block_position) const {
+    while (position < limit) {
+        size_t room = lane.segment_size - position % lane.segment_size;
+        if (room < sizeof(QueueBlock)) {
+            position += room;  // Too short for a header, the producer skipped it
+            continue;
+        }
+
+        QueueBlock header;
+        copy_out(lane, position, &header, sizeof(QueueBlock));
+        if (header.type != BlockType::Padding) {
+            block_position = position;
+            return true;
+        }
+        if (header.total_length < sizeof(QueueBlock) || position + header.total_length > limit) {
+            break;  // Stale header, another consumer moved the head
+        }
+        position += header.total_length;
+    }
+    block_position = std::min(position, limit);
+    return false;
+}
+
+// Take the next turn of the weighted round robin
+size_t RingQueue::first_lane() {
+    if (lane_count_ == 1) {
+        return 0;
+    }
+    return schedule_[control_->ticket.fetch_add(1, std::memory_order_relaxed) % schedule_.size()];
+}
+
+// The scheduled lane first, then the others in priority order
+size_t RingQueue::pick_lane(size_t first, size_t attempt) const {
+    if (attempt == 0) {
+        return first;
+    }
+    return (attempt - 1 < first) ? attempt - 1 : attempt;
+}
+
+bool RingQueue::claim(QueueSpan& span, QueueBlock& block_header, BlockGuard* guard) {
+    size_t first = first_lane();
+    for (size_t attempt = 0; attempt < lane_count_; ++attempt) {
+        if (claim_lane(pick_lane(first, attempt), span, block_header, guard)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Claim the block at the head of a lane, returns false if empty or vetoed by the guard
+bool RingQueue::claim_lane(size_t lane_index, QueueSpan& span, QueueBlock& block_header, BlockGuard* guard) {
+    QueueLane& lane = lanes_[lane_index];
     while (true) {
-        size_t current_read = read_index_.load(std::memory_order_acquire);
-        size_t current_write = write_index_.load(std::memory_order_acquire);
-
-        // If there is data to read
-        if (current_read != current_write) {
-            size_t used_space = get_used_space();
-
-            // Read the header information to get the block length
-            if (used_space > sizeof(QueueBlock)) {
-                // First, read the header information
-                size_t read_pos = current_read % buffer_size_;
-                std::memcpy(&block_header, buffer_ + read_pos, sizeof(QueueBlock));
-
-                actual_length = block_header.total_length - sizeof(QueueBlock);
-
-                if (actual_length > max_buffer_size) {
-                    LOG_ERR("ring queue buffer size %d not enough, need %d.", max_buffer_size, actual_length);
-                    return false;  // The provided buffer is not large enough
-                }
-
-                // Calculate remaining space
-                size_t remaining_space_at_end = buffer_size_ - read_pos;
-
-                if (remaining_space_at_end >= block_header.total_length) {
-                    // Read the data
-                    std::memcpy(data, buffer_ + read_pos + sizeof(QueueBlock), actual_length);
-                } else {
-                    // Read in two parts
-                    std::memcpy(data, buffer_ + read_pos + sizeof(QueueBlock), remaining_space_at_end - sizeof(QueueBlock));
-                    std::memcpy(data + remaining_space_at_end - sizeof(QueueBlock), buffer_, actual_length - (remaining_space_at_end - sizeof(QueueBlock)));
-                }
-
-                // Update the read index
-                read_index_.store(current_read + block_header.total_length, std::memory_order_release);
-                return true;
-            } else {
-                // Not enough space, might be padding or invalid data
+        size_t current_read = lane.read_head.load(std::memory_order_acquire);
+        size_t current_write = lane.write_tail.load(std::memory_order_acquire);
+        size_t block_position;
+        if (!next_block(lane, current_read, current_write, block_position)) {
+            if (block_position == current_read) {
                 return false;
             }
+            // Only padding is left, consume it so the lane reads as empty
+            if (lane.read_head.compare_exchange_weak(current_read, block_position,
+                                                     std::memory_order_acq_rel, std::memory_order_relaxed)) {
+                advance_read_tail(lane);
+            }
+            continue;
+        }
+
+        // Read the header to learn the block length, then claim the block
+        copy_out(lane, block_position, &block_header, sizeof(QueueBlock));
+        size_t total_length = block_header.total_length;
+        if (total_length < sizeof(QueueBlock) || block_position + total_length > current_write) {
+            continue;  // The header was stale, look at the new head
+        }
+        if (guard && !guard->try_acquire(block_header)) {
+            if (lane.read_head.load(std::memory_order_acquire) != current_read) {
+                continue;  // The header was stale, look at the new head
+            }
+            return false;
+        }
+        if (!lane.read_head.compare_exchange_weak(current_read, block_position + total_length,
+                                                  std::memory_order_acq_rel, std::memory_order_relaxed)) {
+            if (guard) {
+                guard->release(block_header);
+            }
+            continue;  // Another consumer claimed it first
+        }
+
+        span.lane = lane_index;
+        span.position = block_position;
+        span.data = lane.block_at(block_position) + sizeof(QueueBlock);
+        span.length = total_length - sizeof(QueueBlock);
+        return true;
+    }
+}
+
+size_t RingQueue::claim_batch(QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, size_t max_bytes, BlockGuard* guard,
+                              ClaimIntent* intent) {
+    size_t first = first_lane();
+    for (size_t attempt = 0; attempt < lane_count_; ++attempt) {
+        size_t claimed = claim_lane_batch(pick_lane(first, attempt), spans, block_headers, max_blocks, max_bytes, guard, intent);
+        if (claimed > 0) {
+            return claimed;
+        }
+    }
+    return 0;
+}
+
+// True if an earlier block of the batch belongs to the same connection, the guard is asked once per connection
+static bool guarded_before(const QueueBlock* block_headers, size_t index) {
+    for (size_t i = 0; i < index; ++i) {
+        if (block_headers[i].connection == block_headers[index].connection &&
+            block_headers[i].generation == block_headers[index].generation) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void release_guarded(BlockGuard* guard, const QueueBlock* block_headers, size_t count) {
+    for (size_t i = 0; guard && i < count; ++i) {
+        if (!guarded_before(block_headers, i)) {
+            guard->release(block_headers[i]);
+        }
+    }
+}
+
+// Claim several consecutive blocks of a lane with one CAS, stopping at the first block the guard vetoes
+size_t RingQueue::claim_lane_batch(size_t lane_index, QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, size_t max_bytes,
+                                   BlockGuard* guard, ClaimIntent* intent) {
+    QueueLane& lane = lanes_[lane_index];
+    while (true) {
+        size_t current_read = lane.read_head.load(std::memory_order_acquire);
+        size_t current_write = lane.write_tail.load(std::memory_order_acquire);
+
+        // Walk the committed headers to find how many blocks to take
+        size_t claimed = 0;
+        size_t position = current_read;
+        size_t bytes = 0;
+        bool stale = false;
+        bool vetoed = false;
+        while (claimed < max_blocks) {
+            size_t block_position;
+            if (!next_block(lane, position, current_write, block_position)) {
+                position = block_position;
+                break;
+            }
+            copy_out(lane, block_position, &block_headers[claimed], sizeof(QueueBlock));
+            size_t total_length = block_headers[claimed].total_length;
+            if (total_length < sizeof(QueueBlock) || block_position + total_length > current_write) {
+                stale = true;  // Another consumer moved the head, the header is not ours
+                break;
+            }
+            size_t length = total_length - sizeof(QueueBlock);
+            if (claimed > 0 && bytes + length > max_bytes) {
+                break;
+            }
+            if (guard && !guarded_before(block_headers, claimed) && !guard->try_acquire(block_headers[claimed])) {
+                vetoed = true;
+                break;
+            }
+            spans[claimed].lane = lane_index;
+            spans[claimed].position = block_position;
+            spans[claimed].data = lane.block_at(block_position) + sizeof(QueueBlock);
+            spans[claimed].length = length;
+            bytes += length;
+            position = block_position + total_length;
+            ++claimed;
+        }
+        if (stale || (vetoed && claimed == 0 && lane.read_head.load(std::memory_order_acquire) != current_read)) {
+            release_guarded(guard, block_headers, claimed);
+            continue;
+        }
+        if (position == current_read) {
+            return 0;
+        }
+        if (intent && claimed > 0) {
+            // Published before read_head moves, a consumer dying right after the CAS leaves its claim behind
+            intent->lane.store(lane_index, std::memory_order_relaxed);
+            intent->count.store(claimed, std::memory_order_relaxed);
+            intent->start.store(current_read, std::memory_order_seq_cst);
+        }
+        if (!lane.read_head.compare_exchange_strong(current_read, position,
+                                                    std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            if (intent) {
+                intent->start.store(NO_CLAIM, std::memory_order_seq_cst);
+            }
+            release_guarded(guard, block_headers, claimed);
+            continue;
+        }
+        if (claimed == 0) {
+            advance_read_tail(lane);  // Only padding was claimed
+            continue;
+        }
+        return claimed;
+    }
+}
+
+// Give a claimed block back; whoever releases the block at the tail moves the tail over it
+void RingQueue::release(const QueueSpan& span) {
+    QueueLane& lane = lanes_[span.lane];
+    __atomic_store_n(type_of(lane.block_at(span.position)), (char)BlockType::Padding, __ATOMIC_SEQ_CST);
+    advance_read_tail(lane);
+}
+
+void RingQueue::recover(const QueueSpan& span) {
+    // Positions only grow, so a block behind read_tail was released and its space may be reused already
+    QueueLane& lane = lanes_[span.lane];
+    if (span.position >= lane.read_tail.load(std::memory_order_seq_cst)) {
+        release(span);
+    }
+}
+
+bool RingQueue::is_claimed(size_t lane_index, size_t position) const {
+    const QueueLane& lane = lanes_[lane_index];
+    return position >= lane.read_tail.load(std::memory_order_seq_cst) &&
+           position < lane.read_head.load(std::memory_order_seq_cst);
+}
+
+void RingQueue::advance_read_tail(QueueLane& lane) {
+    size_t current_tail = lane.read_tail.load(std::memory_order_seq_cst);
+    while (current_tail < lane.read_head.load(std::memory_order_seq_cst)) {
+        size_t next = current_tail;
+        size_t room = lane.segment_size - current_tail % lane.segment_size;
+        if (room < sizeof(QueueBlock)) {
+            next += room;
         } else {
-            // If there is no data, wait
-            if (cond_var_.wait_for(lock, timeout) == std::cv_status::timeout) {
-                return false;  // Timeout
+            // Stop at the first block still held by a consumer, its owner will continue from there
+            char* header = lane.block_at(current_tail);
+            if (__atomic_load_n(type_of(header), __ATOMIC_SEQ_CST) != (char)BlockType::Padding) {
+                return;
+            }
+            uint32_t total_length;
+            std::memcpy(&total_length, header + offsetof(QueueBlock, total_length), sizeof(total_length));
+            next += total_length;
+        }
+        if (lane.read_tail.compare_exchange_weak(current_tail, next, std::memory_order_seq_cst)) {
+            if (elastic_) {
+                retire_segments(lane, current_tail, next);
             }
+            current_tail = next;
         }
     }
 }
 
-// Reserved function: enable or disable padding
-void RingQueue::enable_padding(bool enable) {
-    padding_enabled_ = enable;
+// Claim the head block in place
+bool RingQueue::peek(QueueSpan& span, QueueBlock& block_header, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (true) {
+        if (claim(span, block_header, nullptr)) {
+            return true;
+        }
+
+        // If there is no data, park until a producer publishes or the timeout expires
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline || has_pending_work()) {
+            return false;  // Timeout
+        }
+        wait_for_data(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1));
+    }
+}
+
+// Claim several blocks in place
+size_t RingQueue::peek_batch(QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, std::chrono::milliseconds timeout,
+                             ClaimIntent* intent) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+
+    while (true) {
+        size_t claimed = claim_batch(spans, block_headers, max_blocks, SIZE_MAX, nullptr, intent);
+        if (claimed > 0) {
+            return claimed;
+        }
+
+        // If there is no data, park until a producer publishes or the timeout expires
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline || has_pending_work()) {
+            return 0;  // Timeout
+        }
+        wait_for_data(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1));
+    }
+}
+
+// Claim the head block in place without waiting, if the guard accepts it
+bool RingQueue::try_peek(QueueSpan& span, QueueBlock& block_header, BlockGuard* guard) {
+    return claim(span, block_header, guard);
+}
+
+// Claim up to `max_blocks` blocks in place without waiting, stopping at the first block the guard vetoes
+size_t RingQueue::try_peek_batch(QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, BlockGuard* guard) {
+    return claim_batch(spans, block_headers, max_blocks, SIZE_MAX, guard, nullptr);
+}
+
+// Pop a data block from the queue
+bool RingQueue::wait_and_pop(char* data, size_t max_buffer_size, size_t& actual_length, QueueBlock& block_header, std::chrono::milliseconds timeout) {
+    QueueSpan span;
+    if (!peek(span, block_header, timeout)) {
+        return false;
+    }
+
+    actual_length = span.length;
+    bool fits = actual_length <= max_buffer_size;
+    if (fits) {
+        std::memcpy(data, span.data, actual_length);
+    } else {
+        LOG_ERR("ring queue buffer size %zu not enough, need %zu, block dropped.", max_buffer_size, actual_length);
+    }
+    release(span);
+    return fits;
+}
+
+// Pop several blocks with one claim, copying them out back to back
+size_t RingQueue::pop_batch(char* data, size_t max_buffer_size, QueueBlock* block_headers, size_t* lengths, size_t max_blocks, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    QueueSpan spans[64];
+    max_blocks = std::min(max_blocks, sizeof(spans) / sizeof(spans[0]));
+
+    while (true) {
+        size_t claimed = claim_batch(spans, block_headers, max_blocks, max_buffer_size, nullptr, nullptr);
+        size_t popped = 0;
+        size_t offset = 0;
+        for (size_t i = 0; i < claimed; ++i) {
+            if (offset + spans[i].length <= max_buffer_size) {
+                std::memcpy(data + offset, spans[i].data, spans[i].length);
+                block_headers[popped] = block_headers[i];
+                lengths[popped] = spans[i].length;
+                offset += spans[i].length;
+                ++popped;
+            } else {
+                LOG_ERR("ring queue buffer size %zu not enough, need %zu, block dropped.", max_buffer_size, spans[i].length);
+            }
+            release(spans[i]);
+        }
+        if (popped > 0) {
+            return popped;
+        }
+        if (claimed > 0) {
+            continue;
+        }
+
+        // If there is no data, park until a producer publishes or the timeout expires
+        auto now = std::chrono::steady_clock::now();
+        if (now >= deadline || has_pending_work()) {
+            return 0;  // Timeout
+        }
+        wait_for_data(std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now) + std::chrono::milliseconds(1));
+    }
+}
+
+// Pop the block at the head without waiting, if the guard accepts it
+bool RingQueue::try_pop(char* data, size_t max_buffer_size, size_t& actual_length, QueueBlock& block_header, BlockGuard* guard) {
+    QueueSpan span;
+    if (!claim(span, block_header, guard)) {
+        return false;
+    }
+
+    actual_length = span.length;
+    bool fits = actual_length <= max_buffer_size;
+    if (fits) {
+        std::memcpy(data, span.data, actual_length);
+    } else {
+        LOG_ERR("ring queue buffer size %zu not enough, need %zu, block dropped.", max_buffer_size, actual_length);
+        if (guard) {
+            guard->release(block_header);
+        }
+    }
+    release(span);
+    return fits;
+}
+
+// Wait until the queue is not empty or the timeout expires
+void RingQueue::wait_for_data(std::chrono::milliseconds timeout) {
+    // Data arriving within a few microseconds is picked up without a syscall
+    for (int i = 0; i < spin_count_; ++i) {
+        if (!empty() || has_pending_work()) {
+            return;
+        }
+        cpu_relax();
+    }
+    for (int i = 0; i < yield_count_; ++i) {
+        if (!empty() || has_pending_work()) {
+            return;
+        }
+        std::this_thread::yield();
+    }
+
+    uint32_t seq = control_->wake_seq.load(std::memory_order_acquire);
+    control_->waiters.fetch_add(1, std::memory_order_seq_cst);
+    if (empty() && !has_pending_work()) {
+        park(seq, timeout);
+    }
+    control_->waiters.fetch_sub(1, std::memory_order_seq_cst);
+}
+
+void RingQueue::set_wait_policy(int spin_count, int yield_count) {
+    spin_count_ = std::max(0, spin_count);
+    yield_count_ = std::max(0, yield_count);
+}
+
+bool RingQueue::prepare_wait() {
+    control_->fd_waiting.store(true, std::memory_order_seq_cst);
+    if (!empty()) {
+        control_->fd_waiting.store(false, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+void RingQueue::finish_wait() {
+    control_->fd_waiting.store(false, std::memory_order_relaxed);
+}
+
+size_t RingQueue::size() const {
+    size_t used = 0;
+    for (size_t i = 0; i < lane_count_; ++i) {
+        used += get_used_space(lanes_[i]);
+    }
+    return used;
+}
+
+bool RingQueue::has_space(size_t length, const QueueBlock& block_header) const {
+    const QueueLane& lane = lane_of(block_header);
+    size_t total_length = length + sizeof(QueueBlock);
+    return total_length <= lane.segment_size && get_free_space(lane) >= 2 * total_length;
 }
 
-// Reserved function: insert padding block if needed
-void RingQueue::insert_padding_if_needed() {
-    if (padding_enabled_) {
-        // Logic to insert padding block, currently empty
+size_t RingQueue::resident_bytes() {
+    if (!elastic_) {
+        return lane_count_ * segment_size_;
     }
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    return (all_segments_.size() - cold_segments_.size()) * segment_size_;
 }
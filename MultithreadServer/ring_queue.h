@@ -2,55 +2,373 @@
 #define RING_QUEUE_H
 
 #include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <mutex>
+#include <vector>
+#ifndef __linux__
 #include <condition_variable>
-#include <chrono>
-
-#include "socket_info.h"
+#endif
 
 // Enumeration of block types
 enum class BlockType : char {
     Data,    // Data block
-    Padding, // Padding block for alignment
-    Final    // End of message block, indicating connection closure
+    Padding, // Padding block keeping blocks contiguous, also marks released blocks
+    Final,   // End of message block, indicating connection closure
+    Indirect, // Data block whose message is an out-of-line Payload, see payload.h
+    Chunk    // Part of a streamed response, more blocks of the same request follow.
+             // Out of line like Indirect, except in a shared queue where it is inline.
 };
 
-// Structure of a data block in the ring queue
+// Structure of a data block in the ring queue. The header only names the
+// connection, its socket metadata stays in the connection table.
 struct QueueBlock {
     uint32_t total_length;      // Total length of the block, including header and data
-    uint64_t block_id;          // Block ID
+    uint32_t connection;        // Connection handle, the socket fd indexing the connection table
+    uint32_t sequence;          // Per-connection request number, a response carries its request's
+    uint16_t generation;        // Generation of the connection's table slot when the request arrived
     BlockType type;             // Type of the data block
-    SocketInfo socket_info;     // Socket information associated with this block
-    uint16_t accept_fd;         // Socket accepting the client connection
+    uint8_t lane;               // Priority lane of the block, lane 0 is the most urgent
+    uint32_t timestamp;         // queue_clock() when the request was queued
+    uint32_t budget;            // Microseconds after timestamp the client still waits, 0 for no deadline
     char data[];                // Variable-length data part
 };
+static_assert(sizeof(QueueBlock) == 24, "QueueBlock header must stay 24 bytes");
+
+// Microseconds of the monotonic clock, wrapping, used to measure queue delay
+inline uint32_t queue_clock() {
+    return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+constexpr size_t CACHE_LINE_SIZE = 64;
+constexpr size_t MAX_QUEUE_LANES = 8;
+constexpr int MAX_STEAL_BATCH = 256;            // Largest batch a worker claims from a peer's queue at once
+constexpr int MAX_REQUEST_BUDGET_MS = 3600000;  // Largest request deadline, QueueBlock::budget counts microseconds
+
+// Lets a consumer veto the block at the head before claiming it, used to keep
+// one connection's requests from being processed by two workers at once
+class BlockGuard {
+public:
+    virtual ~BlockGuard() = default;
+
+    // Return true if the block may be claimed by this consumer
+    virtual bool try_acquire(const QueueBlock& block_header) = 0;
+
+    // Undo try_acquire when the block was not handed to this consumer after all
+    virtual void release(const QueueBlock& block_header) = 0;
+};
+
+// Payload space reserved inside the ring by reserve(), published by commit()
+struct QueueReservation {
+    size_t lane;      // Lane the space was reserved in
+    size_t start;     // Absolute position where the reservation begins, including padding
+    size_t position;  // Absolute position of the block header
+    size_t end;       // Absolute position where the reservation ends
+    char* data;       // Payload space, contiguous inside the ring
+    size_t length;    // Payload bytes reserved
+};
+
+// A block claimed in place by peek(), handed back to the ring by release()
+struct QueueSpan {
+    size_t lane;        // Lane the block was claimed from
+    size_t position;    // Absolute position of the block header
+    const char* data;   // Payload, contiguous inside the ring
+    size_t length;      // Payload length
+};
+
+// A claim published by a consumer before it moves read_head, so whoever recovers
+// after a consumer process died between the two can tell what it claimed
+struct ClaimIntent {
+    std::atomic<size_t> start;  // read_head the claim moves from, NO_CLAIM when none is in progress
+    std::atomic<size_t> lane;
+    std::atomic<size_t> count;  // Blocks the claim takes, written to the caller's spans
+};
+constexpr size_t NO_CLAIM = SIZE_MAX;
+
+// Slot through which a lane maps one segment of its ring
+struct QueueSegment {
+    std::atomic<size_t> number;   // Number + 1 of the segment it backs, 0 while free
+    std::atomic<char*> memory;    // Kept after the slot is freed, so a stale reader still reads mapped memory
+};
+
+// One FIFO ring of a queue, each index on its own cache line so producers and
+// consumers do not false-share. The ring is made of segments: segment n backs
+// positions [n * segment_size, (n + 1) * segment_size) and lives in slot n % segment_count.
+struct QueueLane {
+    QueueSegment* segments;   // Slots the segments are mapped through
+    size_t segment_count;     // Number of slots
+    size_t segment_size;      // Bytes per segment, no block crosses a segment boundary
+    size_t capacity;          // Bytes that may be queued at once
+    char pad0[CACHE_LINE_SIZE];
+    std::atomic<size_t> write_head;   // End of the space reserved by producers
+    char pad1[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> write_tail;   // End of the blocks visible to consumers
+    char pad2[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> read_head;    // End of the blocks claimed by consumers
+    char pad3[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> read_tail;    // End of the space given back to producers
+    char pad4[CACHE_LINE_SIZE - sizeof(std::atomic<size_t>)];
+
+    char* block_at(size_t position) const {
+        const QueueSegment& segment = segments[(position / segment_size) % segment_count];
+        return segment.memory.load(std::memory_order_acquire) + position % segment_size;
+    }
+};
 
+// Consumer scheduling and parking state of a queue
+struct QueueControl {
+    std::atomic<uint32_t> ticket;      // Position of the consumers in the lane schedule
+    char pad0[CACHE_LINE_SIZE - sizeof(std::atomic<uint32_t>)];
+    std::atomic<uint32_t> wake_seq;    // Futex word, bumped on every wake
+    std::atomic<uint32_t> waiters;     // Number of parked consumers
+    std::atomic<bool> fd_waiting;      // A waiter sleeps on the wake descriptor
+    char pad1[CACHE_LINE_SIZE - 2 * sizeof(std::atomic<uint32_t>) - sizeof(std::atomic<bool>)];
+};
+
+// Bounded lock-free MPMC queue of variable-length blocks, made of one or more
+// priority lanes. Each lane is a ring: producers reserve space by CAS on
+// write_head and publish in reservation order through write_tail; consumers
+// claim blocks by CAS on read_head.
+// A block never wraps around the end of the ring: a padding block fills the
+// tail instead, so every payload can be used in place. Released blocks are
+// marked as padding and read_tail is advanced over every released block at
+// the tail, so a consumer holding a block does not stall the others.
+// Consumers pick a lane by weighted round robin over the lanes' weights and
+// fall back to the other lanes in priority order when it is empty, so no lane
+// starves while busy lanes keep their share.
+// An elastic queue maps each segment only while it holds blocks: the producer
+// whose reservation enters a segment takes memory from the queue's pool, and
+// the consumer that moves read_tail past it hands it back. The pool keeps a few
+// drained segments warm and gives the pages of the others back to the system,
+// so memory follows the backlog up to the queue size without ever reallocating.
+// An idle consumer spins, then yields, then parks on a futex, and producers
+// only issue a wake when someone is parked. A thread that sleeps elsewhere
+// (e.g. in epoll) can be woken through a file descriptor instead.
+// A shared queue keeps its rings and control block in a shared mapping, so
+// processes forked after its construction produce and consume through it.
 class RingQueue {
 public:
-    RingQueue(size_t buffer_size);  // buffer_size represents the total size of the queue
+    // buffer_size represents the total size of the queue, split evenly across the lanes.
+    // A private queue with a segment_size below a lane's size is elastic, otherwise
+    // each lane is one segment allocated up front.
+    RingQueue(size_t buffer_size, const std::vector<int>& lane_weights = std::vector<int>(1, 1), bool shared = false,
+              size_t segment_size = 0);
     ~RingQueue();
 
-    // Push a data block into the queue
+    RingQueue(const RingQueue&) = delete;
+    RingQueue& operator=(const RingQueue&) = delete;
+
+    // Push a data block into the lane named by its header
     bool push(const char* data, size_t length, const QueueBlock& block_header);
+    // Push up to `count` blocks of one lane with a single reservation, returns the number pushed
+    size_t push_batch(const QueueBlock* block_headers, const char* const* data, const size_t* lengths, size_t count);
     // Pop a data block from the queue, returns the actual data length
     bool wait_and_pop(char* data, size_t max_buffer_size, size_t& actual_length, QueueBlock& block_header, std::chrono::milliseconds timeout);
+    // Pop up to `max_blocks` blocks with a single claim; their data is stored back to back in `data`
+    size_t pop_batch(char* data, size_t max_buffer_size, QueueBlock* block_headers, size_t* lengths, size_t max_blocks, std::chrono::milliseconds timeout);
+    // Pop the head block without waiting, only if the guard accepts it
+    bool try_pop(char* data, size_t max_buffer_size, size_t& actual_length, QueueBlock& block_header, BlockGuard* guard);
+
+    // Reserve `length` payload bytes in place in `lane`, returns false if it is full.
+    // Every reservation must be closed by commit() or cancel(); later reservations
+    // in the lane are published only after it.
+    bool reserve(size_t length, size_t lane, QueueReservation& reservation);
+    // Publish the first `length` bytes of a reservation as one block
+    void commit(const QueueReservation& reservation, const QueueBlock& block_header, size_t length);
+    // Give a reservation back without publishing a block
+    void cancel(const QueueReservation& reservation);
+
+    // Claim the head block in place, the payload stays valid until release()
+    bool peek(QueueSpan& span, QueueBlock& block_header, std::chrono::milliseconds timeout);
+    // Claim up to `max_blocks` blocks of one lane in place with a single claim. With an
+    // intent, the claim is published there first; the caller clears it once it has
+    // recorded the claimed blocks.
+    size_t peek_batch(QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, std::chrono::milliseconds timeout,
+                      ClaimIntent* intent = nullptr);
+    // Claim the head block in place without waiting, only if the guard accepts it
+    bool try_peek(QueueSpan& span, QueueBlock& block_header, BlockGuard* guard);
+    // Claim up to `max_blocks` blocks of one lane without waiting. The guard is asked once per
+    // connection in the batch, release it once per connection after its last block.
+    size_t try_peek_batch(QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, BlockGuard* guard);
+    // Give a peeked block back to producers, blocks may be released in any order
+    void release(const QueueSpan& span);
+    // Release a block claimed by a consumer that died, unless it was already given back
+    void recover(const QueueSpan& span);
+    // Return true if the block at `position` of `lane` is claimed and not yet released
+    bool is_claimed(size_t lane, size_t position) const;
+
+    // Wait until the queue holds data or the timeout expires: spin `spin_count`
+    // times, yield `yield_count` times, then park
+    void wait_for_data(std::chrono::milliseconds timeout);
+    void set_wait_policy(int spin_count, int yield_count);
 
-    // Reserved functions: for future expansion of padding functionality
-    void enable_padding(bool enable);
-    void insert_padding_if_needed();
+    // Consumers stop waiting and do not park while `*pending` is non-zero, so work
+    // queued outside the queue is picked up promptly. Whoever raises it calls wake().
+    void set_pending_work(const std::atomic<size_t>* pending) { pending_work_ = pending; }
+    // Wake up to `count` parked consumers
+    void wake(int count);
+
+    // Write a byte to `fd` when data arrives while a waiter sleeps outside the queue
+    void set_wake_fd(int fd) { wake_fd_ = fd; }
+    // Register such a waiter, returns false if the queue already holds data
+    bool prepare_wait();
+    void finish_wait();
+    // Bytes currently queued
+    size_t size() const;
+    // Return true if a block of `length` bytes, with the padding it may need, fits the
+    // lane named by the header right now. Other producers may take the space first.
+    bool has_space(size_t length, const QueueBlock& block_header) const;
+    // Number of lanes, a header lane beyond the last one is queued in the last one
+    size_t lanes() const { return lane_count_; }
+    bool is_shared() const { return shared_; }
+    // False if the queue memory could not be allocated
+    bool valid() const;
+    // Bytes of segment memory resident, including the warm segments of the pool
+    size_t resident_bytes();
 
 private:
-    size_t buffer_size_;  // Total size of the ring queue
-    char* buffer_;        // Continuous memory block
-    std::atomic<size_t> write_index_;
-    std::atomic<size_t> read_index_;
-    std::mutex mutex_;
+    bool shared_;                      // Rings and control block live in a shared mapping
+    bool elastic_;                     // Segments are mapped on demand
+    char* region_;                     // Memory holding the control block and the lanes
+    size_t region_size_;
+    QueueControl* control_;
+    QueueLane* lanes_;
+    size_t lane_count_;
+    std::vector<uint8_t> schedule_;    // Lane order of one weighted round-robin cycle
+    int spin_count_;                   // Empty checks with a pause before yielding
+    int yield_count_;                  // Empty checks with a yield before parking
+    int wake_fd_;                      // Descriptor written to wake a waiter outside the queue, -1 if none
+    const std::atomic<size_t>* pending_work_; // Work for the consumers outside the queue, nullptr if none
+    size_t segment_size_;              // Segment size of an elastic queue
+    std::mutex pool_mutex_;            // Guards the segment pool
+    std::vector<char*> warm_segments_; // Drained segments kept resident
+    std::vector<char*> cold_segments_; // Drained segments whose pages were given back
+    std::vector<char*> all_segments_;  // Every segment allocated, freed on destruction
+#ifndef __linux__
+    std::mutex mutex_;                 // Parking fallback without futex
     std::condition_variable cond_var_;
+#endif
+
+    size_t get_free_space(const QueueLane& lane) const;
+    size_t get_used_space(const QueueLane& lane) const;
+    bool empty() const;
+    bool has_pending_work() const {
+        return pending_work_ && pending_work_->load(std::memory_order_seq_cst) != 0;
+    }
+    QueueLane& lane_of(const QueueBlock& block_header) const;
+
+    // Writable address of a reserved position, waiting for its segment to be mapped
+    char* writable_at(QueueLane& lane, size_t position);
+    // Number of segments a reservation over [start, end) enters
+    size_t segments_entered(const QueueLane& lane, size_t start, size_t end) const;
+    // Take a segment from the pool, allocating one if it is empty, nullptr on failure
+    char* take_segment();
+    // Make sure a reservation over [start, end) has memory for the segment it enters
+    bool prepare_segment(const QueueLane& lane, size_t start, size_t end, char*& segment);
+    // After the reservation was made, map that memory, or give it back if it was not needed
+    void finish_segment(QueueLane& lane, size_t start, size_t end, char* segment);
+    void return_segment(char* memory);
+    // Map `memory` as segment `number`, unless an earlier, cancelled reservation already did
+    void install_segment(QueueLane& lane, size_t number, char* memory);
+    // Hand back the segments read_tail has passed moving from `from` to `to`
+    void retire_segments(QueueLane& lane, size_t from, size_t to);
+
+    // Copy into / out of a lane at an absolute position, blocks never wrap
+    void copy_in(QueueLane& lane, size_t position, const void* src, size_t length);
+    void copy_out(const QueueLane& lane, size_t position, void* dst, size_t length) const;
+
+    // Padding a block of `total_length` needs at `position` to stay contiguous
+    size_t padding_before(const QueueLane& lane, size_t position, size_t total_length) const;
+    // Fill `length` bytes at `position` with a padding block; a gap too short
+    // for a header is recognised by its position instead
+    void insert_padding_if_needed(QueueLane& lane, size_t position, size_t length);
+    // Reserve a contiguous block, returns the start of the reservation and the block position
+    bool reserve_space(QueueLane& lane, size_t total_length, size_t& start, size_t& position);
+    // Publish a reservation up to `end`, giving the rest back or padding it
+    void finish_reservation(const QueueReservation& reservation, size_t end);
 
-    bool padding_enabled_;  // Indicates if padding is enabled
+    // Find the first block at or after `position`, skipping padding. Returns
+    // false when no block is published before `limit`; `block_position` is then
+    // the end of the padding that can be claimed.
+    bool next_block(const QueueLane& lane, size_t position, size_t limit, size_t& block_position) const;
+    // Lane a consumer should try after `attempt` failed ones
+    size_t pick_lane(size_t first, size_t attempt) const;
+    size_t first_lane();
+    // Claim the head block, or up to `max_blocks` blocks holding at most `max_bytes`
+    bool claim(QueueSpan& span, QueueBlock& block_header, BlockGuard* guard);
+    bool claim_lane(size_t lane, QueueSpan& span, QueueBlock& block_header, BlockGuard* guard);
+    size_t claim_batch(QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, size_t max_bytes, BlockGuard* guard,
+                       ClaimIntent* intent);
+    size_t claim_lane_batch(size_t lane, QueueSpan* spans, QueueBlock* block_headers, size_t max_blocks, size_t max_bytes,
+                            BlockGuard* guard, ClaimIntent* intent);
+    // Advance read_tail over every released block at the tail of a lane
+    void advance_read_tail(QueueLane& lane);
 
-    size_t get_free_space() const;
-    size_t get_used_space() const;
+    // Park until woken or the timeout elapses
+    void park(uint32_t seq, std::chrono::milliseconds timeout);
+};
+
+// Maximum number of blocks a QueueBatch collects before pushing them
+constexpr size_t QUEUE_BATCH_CAPACITY = 64;
+
+// Collects blocks and pushes them to a queue with one reservation, a block of
+// another lane pushes the batch first. The data pointers must stay valid until
+// the blocks are pushed; blocks the queue has no room for stay in the batch.
+class QueueBatch {
+public:
+    explicit QueueBatch(RingQueue& queue) : queue_(queue), count_(0) {}
+    ~QueueBatch() { flush(); }
+
+    // Add a block, pushing the batch first if it is full. Returns false, without
+    // adding the block, if the blocks before it could not all be pushed.
+    bool add(const char* data, size_t length, const QueueBlock& block_header) {
+        if (count_ == QUEUE_BATCH_CAPACITY || (count_ > 0 && headers_[0].lane != block_header.lane)) {
+            flush();
+            if (count_ > 0) {
+                return false;
+            }
+        }
+        headers_[count_] = block_header;
+        data_[count_] = data;
+        lengths_[count_] = length;
+        ++count_;
+        return true;
+    }
+
+    // Push the collected blocks in order, returns how many were pushed. The
+    // blocks that did not fit stay in the batch, size() tells how many.
+    size_t flush() {
+        size_t pushed = 0;
+        while (pushed < count_) {
+            size_t count = queue_.push_batch(headers_ + pushed, data_ + pushed, lengths_ + pushed, count_ - pushed);
+            if (count == 0) {
+                break;
+            }
+            pushed += count;
+        }
+        for (size_t i = pushed; i < count_; ++i) {
+            headers_[i - pushed] = headers_[i];
+            data_[i - pushed] = data_[i];
+            lengths_[i - pushed] = lengths_[i];
+        }
+        count_ -= pushed;
+        return pushed;
+    }
+
+    // Drop the blocks that are not pushed yet
+    void clear() { count_ = 0; }
+
+    size_t size() const { return count_; }
+    // Header of the i-th block not pushed yet
+    const QueueBlock& header(size_t i) const { return headers_[i]; }
+
+private:
+    RingQueue& queue_;
+    QueueBlock headers_[QUEUE_BATCH_CAPACITY];
+    const char* data_[QUEUE_BATCH_CAPACITY];
+    size_t lengths_[QUEUE_BATCH_CAPACITY];
+    size_t count_;
 };
 
 #endif // RING_QUEUE_H
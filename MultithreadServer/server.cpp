@@ -1,15 +1,25 @@
 #include "server.h"
 
+#include <algorithm>
+#include <cstdlib>
 #include <cstring>
 #include <fstream>
 #include <sstream>
 #include <unistd.h>
+#include <fcntl.h>
+#include <csignal>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
 #include <arpa/inet.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
 
 #include "configuration_manager.h"
 #include "default_config.h"
+#include "memory_manager.h"
 #ifdef __linux__
 #include "epoll_dispatcher.h"
 #define USE_EPOLL
@@ -17,6 +27,144 @@
 #include "select_dispatcher.h"
 #endif
 
+// Deadline of the request the calling worker is running, read by server_request_budget()
+static thread_local uint32_t t_request_start = 0;
+static thread_local uint32_t t_request_budget = 0;
+static thread_local request_handle_t t_request_handle;
+// Output stream of the calling worker, for the server_output_* calls
+static thread_local OutputStream* t_output = nullptr;
+// Version of each handler module the calling thread runs, moved to the latest one between batches
+static thread_local HandlerSlot t_handlers[MAX_HANDLER_MODULES];
+// Version whose code the calling thread is running, pinned by the tasks and deferred requests it creates
+static thread_local HandlerVersion* t_running = nullptr;
+
+static inline dll_func_t* handler(size_t module) {
+    return t_handlers[module].functions();
+}
+
+// Whether a handler module the calling thread runs exports handle_message_batch
+static bool batch_handlers(size_t modules) {
+    for (size_t module = 0; module < modules; ++module) {
+        if (has_message_batch(handler(module))) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// A posted task keeps the handler version that posted it loaded until it ran
+struct PostedTask {
+    void (*fn)(void*);
+    void* arg;
+    HandlerVersion* version;
+};
+
+static void run_posted_task(void* arg) {
+    PostedTask* task = (PostedTask*)arg;
+    t_running = task->version;
+    task->fn(task->arg);
+    t_running = nullptr;
+    HandlerRegistry::release(task->version);
+    delete task;
+}
+
+extern "C" int server_request_budget() {
+    if (t_request_budget == 0) {
+        return -1;
+    }
+    uint32_t elapsed = queue_clock() - t_request_start;
+    return elapsed < t_request_budget ? (int)(t_request_budget - elapsed) : 0;
+}
+
+extern "C" request_handle_t server_request_handle() {
+    return t_request_handle;
+}
+
+extern "C" int server_reply(request_handle_t handle, const char* data, int len) {
+    Server* server = Server::instance();
+    return server && server->post_response(handle, len > 0 ? data : nullptr, len > 0 ? len : 0, BlockType::Data) ? 0 : -1;
+}
+
+extern "C" int server_close(request_handle_t handle) {
+    Server* server = Server::instance();
+    return server && server->post_response(handle, nullptr, 0, BlockType::Final) ? 0 : -1;
+}
+
+extern "C" int server_reply_part(request_handle_t handle, const char* data, int len) {
+    Server* server = Server::instance();
+    return server && len > 0 && server->post_response(handle, data, len, BlockType::Chunk) ? 0 : -1;
+}
+
+extern "C" char* server_output_reserve(int min_len, int* available) {
+    size_t space = 0;
+    char* data = t_output && min_len >= 0 ? t_output->reserve(min_len, space) : nullptr;
+    if (available) {
+        *available = (int)space;
+    }
+    return data;
+}
+
+extern "C" int server_output_commit(int len) {
+    return t_output && len >= 0 && t_output->commit(len) ? 0 : -1;
+}
+
+extern "C" int server_output_write(const char* data, int len) {
+    return t_output && len >= 0 && t_output->write(data, len) ? 0 : -1;
+}
+
+extern "C" int server_output_flush() {
+    return t_output && t_output->flush() ? 0 : -1;
+}
+
+extern "C" int server_post(void (*fn)(void*), void* arg) {
+    return server_post_after(0, fn, arg);
+}
+
+extern "C" int server_post_after(int milliseconds, void (*fn)(void*), void* arg) {
+    Server* server = Server::instance();
+    if (!server || !fn) {
+        return -1;
+    }
+    if (t_running) {
+        HandlerRegistry::add_ref(t_running);
+        server->post_task(&run_posted_task, new PostedTask{fn, arg, t_running}, milliseconds);
+    } else {
+        server->post_task(fn, arg, milliseconds);
+    }
+    return 0;
+}
+
+Server* Server::instance_ = nullptr;
+
+// Keeps an ordered connection's requests on one worker at a time in stealing mode
+class InflightGuard : public BlockGuard {
+public:
+    explicit InflightGuard(ConnectionTable* table) : table_(table) {}
+
+    bool try_acquire(const QueueBlock& block_header) override {
+        // A stale block is skipped by the worker, it must not hold up the connection now on its fd
+        ConnectionSlot* slot = table_->get(block_header.connection);
+        if (!slot || !slot->ordered.load(std::memory_order_relaxed) ||
+            slot->generation.load(std::memory_order_acquire) != block_header.generation) {
+            return true;
+        }
+        uint8_t expected = 0;
+        return slot->inflight.compare_exchange_strong(expected, 1, std::memory_order_acq_rel);
+    }
+
+    void release(const QueueBlock& block_header) override {
+        // The fd may have been reopened meanwhile, the flag then belongs to the new connection
+        ConnectionSlot* slot = table_->get(block_header.connection);
+        if (slot && slot->ordered.load(std::memory_order_relaxed) &&
+            slot->generation.load(std::memory_order_acquire) == block_header.generation) {
+            slot->inflight.store(0, std::memory_order_release);
+        }
+    }
+
+private:
+    ConnectionTable* table_;
+};
+
 // Parse the bind configuration file and set flags
 std::vector<BindInfo> parse_bind_file(const std::string& bind_file_path) {
     std::vector<BindInfo> binds;
@@ -37,6 +185,22 @@ std::vector<BindInfo> parse_bind_file(const std::string& bind_file_path) {
         BindInfo bind_info;
         iss >> bind_info.ip >> bind_info.port >> bind_info.type >> bind_info.idle_timeout;
 
+        // Optional column: whether a connection's requests must be processed in order (default 1)
+        int ordered = 1;
+        iss >> ordered;
+        bind_info.ordered = (ordered != 0);
+
+        // Optional column: receive queue lane of the connections' requests (default 0, the most urgent)
+        int lane = 0;
+        iss >> lane;
+        bind_info.lane = (uint8_t)std::max(0, std::min(lane, (int)MAX_QUEUE_LANES - 1));
+
+        // Optional column: handler library of the listener, "-" for the one given on the command line
+        if (!(iss >> bind_info.handler) || bind_info.handler == "-") {
+            bind_info.handler.clear();
+        }
+        bind_info.module = 0;
+
         // Set the appropriate protocol flags based on the type
         if (bind_info.type == "tcp") {
             bind_info.flags = CN_LISTEN_MASK;  // TCP listen flag
@@ -53,9 +217,58 @@ std::vector<BindInfo> parse_bind_file(const std::string& bind_file_path) {
     return binds;
 }
 
+// Parse the comma separated weights of the receive queue lanes, missing weights default to 1
+static std::vector<int> parse_lane_weights(int lanes, const std::string& weights) {
+    if (lanes < 1 || (size_t)lanes > MAX_QUEUE_LANES) {
+        LOG_WARN("Invalid queue_lanes %d, using %d.", lanes, std::max(1, std::min(lanes, (int)MAX_QUEUE_LANES)));
+        lanes = std::max(1, std::min(lanes, (int)MAX_QUEUE_LANES));
+    }
+
+    std::vector<int> lane_weights(lanes, 1);
+    std::istringstream iss(weights);
+    std::string weight;
+    for (int i = 0; i < lanes && std::getline(iss, weight, ','); ++i) {
+        lane_weights[i] = std::max(1, atoi(weight.c_str()));
+    }
+    return lane_weights;
+}
+
+// Stop flag of the supervisor or worker process, set from the signal handler
+static std::atomic<bool>* process_stop_flag = nullptr;
+
+static void handle_process_stop(int) {
+    if (process_stop_flag) {
+        process_stop_flag->store(true);
+    }
+}
+
+// Stop on SIGTERM/SIGINT, leave SIGHUP to the server process
+static void set_process_signals(std::atomic<bool>* stop_flag) {
+    process_stop_flag = stop_flag;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_process_stop;
+    sigaction(SIGTERM, &sa, nullptr);
+    sigaction(SIGINT, &sa, nullptr);
+    sa.sa_handler = SIG_IGN;
+    sigaction(SIGHUP, &sa, nullptr);
+    sigaction(SIGUSR1, &sa, nullptr);  // Reloads are requested from the server process
+#ifdef __linux__
+    prctl(PR_SET_PDEATHSIG, SIGTERM);
+#endif
+}
+
 // Server constructor
-Server::Server(size_t queue_size, int num_workers, dll_func_t* dll_funcs)
-    : recv_queue_(queue_size), send_queue_(queue_size), num_workers_(num_workers), stop_flag_(false), dll_functions_(dll_funcs) {
+Server::Server(size_t queue_size, int num_workers, dll_func_t* dll_funcs, const std::string& dll_path)
+    : queue_size_(queue_size), num_workers_(num_workers), dispatch_mode_(DispatchMode::SHARED),
+      stop_flag_(false), process_mode_(false), supervisor_pid_(-1), journals_(nullptr),
+      steal_batch_(DEFAULT_STEAL_BATCH), stolen_blocks_(0),
+      queue_batch_(DEFAULT_QUEUE_BATCH), task_batch_(DEFAULT_TASK_BATCH),
+      max_held_responses_(DEFAULT_MAX_HELD_RESPONSES), codel_target_(0), codel_interval_(0), request_budget_(0),
+      deadline_stats_(nullptr), copy_stats_(nullptr) {
+    wake_pipe_[0] = -1;
+    wake_pipe_[1] = -1;
+    handlers_.emplace_back(new HandlerRegistry(*dll_funcs, dll_path));
 #ifdef USE_EPOLL
     dispatcher_ = new EpollDispatcher();
 #else
@@ -75,26 +288,337 @@ int Server::start(const std::string& bind_file) {
         return -1;
     }
     
+    // Frames above DEFAULT_INLINE_PAYLOAD travel out of line, so the maximum is only bounded by memory
     int max_pkt_size = ConfigurationManager::getInstance().get_integer("max_packet_size", DEFAULT_MAX_PACKET_SIZE);
-    if (max_pkt_size > DEFAULT_MAX_PACKET_SIZE) {
-        LOG_ERR("Max packet size %d exceed %d.", max_pkt_size, DEFAULT_MAX_PACKET_SIZE);
+    if (max_pkt_size <= 0) {
+        LOG_ERR("Invalid max packet size %d.", max_pkt_size);
         return -1;
     }
     recv_buffer_size_ = ConfigurationManager::getInstance().get_integer("recv_buffer", DEFAULT_RECV_BUFFER_SIZE);
     send_buffer_size_ = ConfigurationManager::getInstance().get_integer("send_buffer", DEFAULT_SEND_BUFFER_SIZE);
+    client_manager_.init_buffer_pools(recv_buffer_size_, send_buffer_size_,
+                                      ConfigurationManager::getInstance().get_integer("buffer_pool_chunk", DEFAULT_BUFFER_POOL_CHUNK),
+                                      max_pkt_size);
+    stats_interval_ = ConfigurationManager::getInstance().get_integer("stats_interval", DEFAULT_STATS_INTERVAL);
+
+    // Requests are split into priority lanes, workers serve them by weighted round robin
+    std::vector<int> lane_weights = parse_lane_weights(
+        ConfigurationManager::getInstance().get_integer("queue_lanes", DEFAULT_QUEUE_LANES),
+        ConfigurationManager::getInstance().get_string("lane_weights", DEFAULT_LANE_WEIGHTS));
+
+    // In process mode the workers are separate processes, so a crashing handler does not take the connections down
+    std::string worker_mode = ConfigurationManager::getInstance().get_string("worker_mode", DEFAULT_WORKER_MODE);
+    process_mode_ = (worker_mode == "process");
+#ifndef __linux__
+    if (process_mode_) {
+        LOG_WARN("worker_mode process needs shared futexes, using thread.");
+        process_mode_ = false;
+    }
+#endif
+    if (!process_mode_ && worker_mode != "thread") {
+        LOG_WARN("Unknown worker_mode %s, using thread.", worker_mode.c_str());
+    }
+
+    // In affinity mode every worker owns a queue, so one connection is always served by one worker
+    std::string dispatch_mode = ConfigurationManager::getInstance().get_string("dispatch_mode", DEFAULT_DISPATCH_MODE);
+    if (process_mode_ && dispatch_mode == "stealing") {
+        LOG_WARN("dispatch_mode stealing is not supported with worker processes, using affinity.");
+        dispatch_mode = "affinity";
+    }
+    // ringqueue_length caps each queue, segments are only mapped while they hold a backlog.
+    // A segment must hold the largest inline block.
+    int segment_size = ConfigurationManager::getInstance().get_integer("ringqueue_segment", DEFAULT_RINGQUEUE_SEGMENT);
+    size_t queue_segment = segment_size > 0 ? std::max<size_t>(segment_size, 4 * DEFAULT_INLINE_PAYLOAD) : 0;
+    if (dispatch_mode == "affinity" || dispatch_mode == "stealing") {
+        dispatch_mode_ = (dispatch_mode == "affinity") ? DispatchMode::AFFINITY : DispatchMode::STEALING;
+        for (int i = 0; i < num_workers_; ++i) {
+            recv_queues_.emplace_back(new RingQueue(queue_size_ / num_workers_, lane_weights, process_mode_, queue_segment));
+        }
+    } else {
+        if (dispatch_mode != "shared") {
+            LOG_WARN("Unknown dispatch_mode %s, using shared.", dispatch_mode.c_str());
+        }
+        dispatch_mode_ = DispatchMode::SHARED;
+        recv_queues_.emplace_back(new RingQueue(queue_size_, lane_weights, process_mode_, queue_segment));
+    }
+    send_queue_.reset(new RingQueue(queue_size_, std::vector<int>(1, 1), process_mode_, queue_segment));
+    if (!send_queue_->valid()) {
+        return -1;
+    }
+    for (auto& recv_queue : recv_queues_) {
+        if (!recv_queue->valid()) {
+            return -1;
+        }
+    }
+
+    // A bind lane past the last lane is served by the last one
+    for (auto& socket_bind : socket_bind_map_) {
+        BindInfo& bind_info = socket_bind.second;
+        if (bind_info.lane >= lane_weights.size()) {
+            LOG_WARN("Lane %d of bind %s:%d is beyond queue_lanes %zu, using lane %zu.", bind_info.lane,
+                     bind_info.ip.c_str(), bind_info.port, lane_weights.size(), lane_weights.size() - 1);
+            bind_info.lane = (uint8_t)(lane_weights.size() - 1);
+        }
+    }
+    int steal_batch = ConfigurationManager::getInstance().get_integer("steal_batch", DEFAULT_STEAL_BATCH);
+    steal_batch_ = std::max(1, std::min(steal_batch, MAX_STEAL_BATCH));
+    if (steal_batch_ != steal_batch) {
+        LOG_WARN("Invalid steal_batch %d, using %d.", steal_batch, steal_batch_);
+    }
+    queue_batch_ = std::max(1, ConfigurationManager::getInstance().get_integer("queue_batch", DEFAULT_QUEUE_BATCH));
+    // Suspended coroutine handlers only resume through the tasks, a worker must run at least one
+    task_batch_ = std::max(1, ConfigurationManager::getInstance().get_integer("task_batch", DEFAULT_TASK_BATCH));
+
+    // Workers shed requests once the queue delay stays above the target, so the rest are served in time
+    codel_target_ = (uint32_t)std::max(0, ConfigurationManager::getInstance().get_integer("codel_target", DEFAULT_CODEL_TARGET)) * 1000;
+    codel_interval_ = (uint32_t)std::max(1, ConfigurationManager::getInstance().get_integer("codel_interval", DEFAULT_CODEL_INTERVAL)) * 1000;
+
+    // A connection whose responses pile up behind a missing one is closed
+    max_held_responses_ = (size_t)std::max(1, ConfigurationManager::getInstance().get_integer("max_held_responses", DEFAULT_MAX_HELD_RESPONSES));
+
+    // Requests still queued when their client stops waiting are skipped, handlers may set a deadline per frame
+    int pkg_timeout = ConfigurationManager::getInstance().get_integer("pkg_timeout", DEFAULT_PKG_TIMEOUT);
+    request_budget_ = (uint32_t)std::max(0, std::min(pkg_timeout, MAX_REQUEST_BUDGET_MS / 1000)) * 1000000;
+    deadline_stats_ = (DeadlineStats*)MemoryManager::allocate(sizeof(DeadlineStats), process_mode_);
+    copy_stats_ = (CopyStats*)MemoryManager::allocate(sizeof(CopyStats), process_mode_);
+    if (!deadline_stats_ || !copy_stats_) {
+        return -1;
+    }
+    for (auto& handlers : handlers_) {
+        if (!handlers->init(process_mode_)) {
+            return -1;
+        }
+    }
+    deadline_stats_->expired = 0;
+    deadline_stats_->expired_bytes = 0;
+    deadline_stats_->late = 0;
+    copy_stats_->requests = 0;
+    copy_stats_->requests_in_place = 0;
+    copy_stats_->request_copies = 0;
+    copy_stats_->request_bytes = 0;
+    copy_stats_->responses = 0;
+    copy_stats_->response_copies = 0;
+    copy_stats_->response_bytes = 0;
+    ProtocolHandler::set_copy_stats(copy_stats_);
+
+    // Idle workers spin, then yield, then park on the queue
+    int queue_spin = ConfigurationManager::getInstance().get_integer("queue_spin", DEFAULT_QUEUE_SPIN);
+    int queue_yield = ConfigurationManager::getInstance().get_integer("queue_yield", DEFAULT_QUEUE_YIELD);
+    for (auto& recv_queue : recv_queues_) {
+        recv_queue->set_wait_policy(queue_spin, queue_yield);
+        recv_queue->set_pending_work(&tasks_.pending());
+    }
+
+    // The network thread sleeps in the dispatcher, workers wake it through a pipe when responses are queued
+    if (pipe(wake_pipe_) != 0) {
+        LOG_CRIT("Failed to create the wake pipe.");
+        return -1;
+    }
+    fcntl(wake_pipe_[0], F_SETFL, fcntl(wake_pipe_[0], F_GETFL) | O_NONBLOCK);
+    fcntl(wake_pipe_[1], F_SETFL, fcntl(wake_pipe_[1], F_GETFL) | O_NONBLOCK);
+    dispatcher_->add_fd(wake_pipe_[0]);
+    send_queue_->set_wake_fd(wake_pipe_[1]);
+
+    // Slots are indexed by fd, so the table covers every fd the process may open
+    size_t max_connections = DEFAULT_MAX_CONNECTIONS;
+    rlimit fd_limit;
+    if (getrlimit(RLIMIT_NOFILE, &fd_limit) == 0 && fd_limit.rlim_cur != RLIM_INFINITY) {
+        max_connections = (size_t)fd_limit.rlim_cur;
+    }
+    connection_table_.reset(new ConnectionTable(max_connections, process_mode_));
+    if (!connection_table_->valid()) {
+        return -1;
+    }
+
+    // Worker processes answer deferred requests through the instance they inherit
+    instance_ = this;
+
+    // Fork before any thread is started
+    if (process_mode_ && start_worker_processes() != 0) {
+        return -1;
+    }
 
     network_thread_ = std::thread(&Server::network_thread_func, this);
 
-    for (int i = 0; i < num_workers_; ++i) {
-        worker_threads_.emplace_back(&Server::worker_thread_func, this, i);
+    if (!process_mode_) {
+        for (int i = 0; i < num_workers_; ++i) {
+            worker_threads_.emplace_back(&Server::worker_thread_func, this, i);
+        }
     }
     
     return 0;
 }
 
+int Server::start_worker_processes() {
+    // The journal spans are claimed in place by peek_batch
+    queue_batch_ = std::min(queue_batch_, (int)QUEUE_BATCH_CAPACITY);
+    journals_ = (WorkerJournal*)MemoryManager::allocate(num_workers_ * sizeof(WorkerJournal), true);
+    if (!journals_) {
+        return -1;
+    }
+    for (int i = 0; i < num_workers_; ++i) {
+        journals_[i].count = 0;
+        journals_[i].done = 0;
+        journals_[i].intent.start = NO_CLAIM;
+    }
+
+    supervisor_pid_ = fork();
+    if (supervisor_pid_ < 0) {
+        LOG_CRIT("Failed to fork the worker supervisor.");
+        return -1;
+    }
+    if (supervisor_pid_ == 0) {
+        supervise_workers();
+        _exit(0);
+    }
+    LOG_INFO("Worker supervisor started, pid: %d", supervisor_pid_);
+    return 0;
+}
+
+void Server::supervise_workers() {
+    set_process_signals(&stop_flag_);
+
+    // Only the server process serves the sockets
+    for (int socket : server_sockets_) {
+        close(socket);
+    }
+    close(wake_pipe_[0]);
+
+    std::vector<pid_t> workers(num_workers_, -1);
+    for (int i = 0; i < num_workers_; ++i) {
+        workers[i] = spawn_worker(i);
+    }
+
+    while (!stop_flag_.load()) {
+        int status = 0;
+        pid_t pid = waitpid(-1, &status, WNOHANG);
+        if (pid <= 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            continue;
+        }
+
+        auto it = std::find(workers.begin(), workers.end(), pid);
+        if (it == workers.end()) {
+            continue;
+        }
+        int worker_id = (int)(it - workers.begin());
+        if (WIFSIGNALED(status)) {
+            LOG_ERR("Worker process %d (pid %d) killed by signal %d, restarting.", worker_id, pid, WTERMSIG(status));
+        } else {
+            LOG_ERR("Worker process %d (pid %d) exited with status %d, restarting.", worker_id, pid, WEXITSTATUS(status));
+        }
+        recover_worker(worker_id);
+
+        // Do not fork in a tight loop if the handler keeps crashing
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        *it = stop_flag_.load() ? -1 : spawn_worker(worker_id);
+    }
+
+    for (pid_t pid : workers) {
+        if (pid > 0) {
+            kill(pid, SIGTERM);
+        }
+    }
+    for (pid_t pid : workers) {
+        if (pid > 0) {
+            waitpid(pid, nullptr, 0);
+        }
+    }
+}
+
+pid_t Server::spawn_worker(int worker_id) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        set_process_signals(&stop_flag_);
+        worker_thread_func(worker_id);
+        _exit(0);
+    }
+    if (pid < 0) {
+        LOG_ERR("Failed to fork worker process %d.", worker_id);
+    } else {
+        LOG_INFO("Worker process %d started, pid: %d", worker_id, pid);
+    }
+    return pid;
+}
+
+// A worker that died while claiming published its claim but did not record it. The claim
+// happened if read_head moved past its start and no live worker sharing the queue holds
+// its first block. A peer in its own claim from the same start settles within moments.
+bool Server::owns_claim(int worker_id) {
+    WorkerJournal& journal = journals_[worker_id];
+    size_t start = journal.intent.start.load(std::memory_order_seq_cst);
+    size_t lane = journal.intent.lane.load(std::memory_order_relaxed);
+    size_t position = journal.spans[0].position;
+    RingQueue& recv_queue = worker_queue(worker_id);
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        // Not claimed by anyone yet, or already released by the consumer that claimed it
+        if (!recv_queue.is_claimed(lane, start) || !recv_queue.is_claimed(lane, position)) {
+            return false;
+        }
+        bool unsettled = false;
+        for (int i = 0; i < num_workers_; ++i) {
+            if (i == worker_id || &worker_queue(i) != &recv_queue) {
+                continue;
+            }
+            WorkerJournal& peer = journals_[i];
+            size_t count = peer.count.load(std::memory_order_acquire);
+            for (size_t k = 0; k < count; ++k) {
+                if (peer.spans[k].lane == lane && peer.spans[k].position == position) {
+                    return false;
+                }
+            }
+            if (peer.intent.start.load(std::memory_order_seq_cst) == start && peer.intent.lane.load(std::memory_order_relaxed) == lane) {
+                unsettled = true;
+            }
+        }
+        // A peer may have released the block and reused its journal while it was read
+        if (!unsettled) {
+            return recv_queue.is_claimed(lane, position);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return false;
+}
+
+void Server::recover_worker(int worker_id) {
+    WorkerJournal& journal = journals_[worker_id];
+    size_t count = journal.count.load(std::memory_order_acquire);
+    size_t done = journal.done.load(std::memory_order_acquire);
+    RingQueue& recv_queue = worker_queue(worker_id);
+    bool unrecorded = false;
+    if (count == 0 && journal.intent.start.load(std::memory_order_seq_cst) != NO_CLAIM && owns_claim(worker_id)) {
+        // The handler never saw a request of an unrecorded claim, all of them go back to the queue
+        count = journal.intent.count.load(std::memory_order_relaxed);
+        done = 0;
+        unrecorded = true;
+        LOG_ERR("Worker process %d died while claiming %zu requests, recovering them.", worker_id, count);
+    }
+    for (size_t i = done; i < count; ++i) {
+        // Requests the worker did not reach go back to the queue. The one it died on is answered
+        // with an empty response so the connection's later responses are not held forever; the
+        // network thread drops it if the worker had queued the real one.
+        if ((i == done && !unrecorded) || !recv_queue.push(journal.spans[i].data, journal.spans[i].length, journal.blocks[i])) {
+            QueueBlock empty_block = journal.blocks[i];
+            empty_block.lane = 0;
+            empty_block.type = BlockType::Data;
+            if (!send_queue_->push(nullptr, 0, empty_block)) {
+                // Without the empty response the connection's later responses have nothing to follow
+                connection_table_->drop_response(empty_block.connection, empty_block.generation);
+            }
+            LOG_ERR("Dropped request %u of fd %u held by worker process %d.",
+                    empty_block.sequence, empty_block.connection, worker_id);
+        }
+        recv_queue.recover(journal.spans[i]);
+    }
+    journal.count = 0;
+    journal.done = 0;
+    journal.intent.start = NO_CLAIM;
+}
+
 // Stop the server
 void Server::stop() {
     stop_flag_.store(true);
+    instance_ = nullptr;
     for (int socket : server_sockets_) {
         close(socket);
     }
@@ -108,12 +632,38 @@ void Server::stop() {
             worker.join();
         }
     }
+
+    if (supervisor_pid_ > 0) {
+        kill(supervisor_pid_, SIGTERM);
+        waitpid(supervisor_pid_, nullptr, 0);
+        supervisor_pid_ = -1;
+    }
+    if (journals_) {
+        MemoryManager::deallocate(journals_, num_workers_ * sizeof(WorkerJournal));
+        journals_ = nullptr;
+    }
+    if (deadline_stats_) {
+        MemoryManager::deallocate(deadline_stats_, sizeof(DeadlineStats));
+        deadline_stats_ = nullptr;
+    }
+    if (copy_stats_) {
+        ProtocolHandler::set_copy_stats(nullptr);
+        MemoryManager::deallocate(copy_stats_, sizeof(CopyStats));
+        copy_stats_ = nullptr;
+    }
+
+    for (int& fd : wake_pipe_) {
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
 }
 
 // Create server sockets based on bind file
 int Server::create_server_sockets(const std::string& bind_file) {
     binds_ = parse_bind_file(bind_file);
-    if (binds_.empty()) {
+    if (binds_.empty() || load_bind_handlers() != 0) {
         return -1;
     }
 
@@ -155,6 +705,34 @@ int Server::create_server_sockets(const std::string& bind_file) {
     return 0;
 }
 
+int Server::load_bind_handlers() {
+    for (auto& bind_info : binds_) {
+        if (bind_info.handler.empty()) {
+            continue;
+        }
+        size_t module = 0;
+        while (module < handlers_.size() && handlers_[module]->path() != bind_info.handler) {
+            ++module;
+        }
+        if (module == handlers_.size()) {
+            if (module == MAX_HANDLER_MODULES) {
+                LOG_CRIT("More than %zu handler libraries in the bind file.", MAX_HANDLER_MODULES);
+                return -1;
+            }
+            dll_func_t functions;
+            if (!load_dll_functions(&functions, bind_info.handler.c_str())) {
+                LOG_CRIT("Failed to load handler %s for %s:%d", bind_info.handler.c_str(), bind_info.ip.c_str(), bind_info.port);
+                return -1;
+            }
+            handlers_.emplace_back(new HandlerRegistry(functions, bind_info.handler));
+            handlers_.back()->set_args(saved_argc_, saved_argv_);
+            LOG_INFO("Handler module %zu loaded from %s.", module, bind_info.handler.c_str());
+        }
+        bind_info.module = (uint8_t)module;
+    }
+    return 0;
+}
+
 // Unified protocol handler function using flags
 ProtocolHandler* Server::get_protocol_handler(int flags) {
     if (flags & CN_UDP_MASK) {
@@ -167,61 +745,198 @@ ProtocolHandler* Server::get_protocol_handler(int flags) {
     }
 }
 
+RingQueue& Server::worker_queue(int worker_id) {
+    return (dispatch_mode_ == DispatchMode::SHARED) ? *recv_queues_[0] : *recv_queues_[worker_id];
+}
+
+RingQueue& Server::select_recv_queue(const ClientInfo& client) {
+    if (dispatch_mode_ != DispatchMode::SHARED) {
+        return *recv_queues_[(size_t)client.socket_info.sock_fd % recv_queues_.size()];
+    }
+    return *recv_queues_[0];
+}
+
 void Server::close_client_connection(SocketInfo* si) {
-    if (dll_functions_->handle_client_close) {
-        dll_functions_->handle_client_close(si);
+    dll_func_t* functions = handler(connection_table_->module(si->sock_fd));
+    if (functions->handle_client_close) {
+        functions->handle_client_close(si);
+    }
+    // `si` may point into the client entry that remove_client() erases
+    int sock_fd = si->sock_fd;
+    connection_table_->close(sock_fd);
+    client_manager_.remove_client(sock_fd, dispatcher_);
+    dispatcher_->remove_fd(sock_fd);
+    close(sock_fd);
+}
+
+// Send one response block to its client
+// Hold a response back until the responses of the connection's earlier requests are sent
+void Server::deliver_in_order(const char* data, size_t length, const QueueBlock& block, Payload* payload) {
+    ClientInfo* client = client_manager_.get_client(block.connection);
+    if (!client) {
+        LOG_TRACE("Failed to get client fd: %u", block.connection);
+        return;
+    }
+
+    // A response to an earlier connection on the same fd
+    if (block.generation != client->generation) {
+        LOG_TRACE("Stale response for client fd: %u, generation %u != %u", block.connection, block.generation, client->generation);
+        return;
+    }
+
+    // The header carries the low 32 bits of the sequence number
+    uint64_t sequence = client->response_seq + (int32_t)(block.sequence - (uint32_t)client->response_seq);
+    if (sequence != client->response_seq) {
+        if (sequence < client->response_seq || holds_response(*client, sequence)) {
+            LOG_TRACE("Duplicate response %llu for client fd: %u", (unsigned long long)sequence, block.connection);
+            return;
+        }
+
+        // Keep a reference to an out-of-line response, copy an inline one out of the queue
+        HeldResponse held;
+        held.type = block.type;
+        held.payload = payload;
+        held.offset = 0;
+        held.length = length;
+        if (payload) {
+            payload->add_ref();
+            held.offset = data - payload->data();
+        } else if (length > 0) {
+            held.payload = Payload::create(length);
+            if (!held.payload) {
+                LOG_ERR("Failed to hold a response for client fd: %u, close conn.", block.connection);
+                close_client_connection(&client->socket_info);
+                return;
+            }
+            std::memcpy(held.payload->data(), data, length);
+        }
+        client->held_responses.emplace(sequence, held);
+        // Responses pile up behind one that is very slow or was lost
+        if (client->held_responses.size() > max_held_responses_) {
+            LOG_ERR("%zu responses wait for response %llu of client fd: %u, close conn.", client->held_responses.size(),
+                    (unsigned long long)client->response_seq, block.connection);
+            close_client_connection(&client->socket_info);
+        }
+        return;
+    }
+
+    if (!deliver_response(*client, data, length, block.type)) {
+        return;
+    }
+    // The parts of a streamed response are sent as they come, its last block completes it
+    if (block.type == BlockType::Chunk) {
+        return;
+    }
+    ++client->response_seq;
+
+    // Send the responses that were waiting for this one
+    while (!client->held_responses.empty() && client->held_responses.begin()->first == client->response_seq) {
+        HeldResponse held = client->held_responses.begin()->second;
+        client->held_responses.erase(client->held_responses.begin());
+        bool open = deliver_response(*client, held.payload ? held.payload->data() + held.offset : nullptr, held.length, held.type);
+        if (held.payload) {
+            held.payload->release();
+        }
+        if (!open) {
+            return;
+        }
+        if (held.type != BlockType::Chunk) {
+            ++client->response_seq;
+        }
     }
-    client_manager_.remove_client(si->sock_fd, dispatcher_);
-    dispatcher_->remove_fd(si->sock_fd);
-    close(si->sock_fd);
+}
+
+// A complete response is held for `sequence`, its parts may be held too
+bool Server::holds_response(const ClientInfo& client, uint64_t sequence) const {
+    auto range = client.held_responses.equal_range(sequence);
+    for (auto it = range.first; it != range.second; ++it) {
+        if (it->second.type != BlockType::Chunk) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Server::deliver_response(ClientInfo& client, const char* data, size_t length, BlockType type) {
+    ProtocolHandler* protocol_handler = get_protocol_handler(client.flag);
+    if (protocol_handler) {
+        if ((type == BlockType::Data || type == BlockType::Indirect || type == BlockType::Chunk) && length > 0) {
+            int send_result = (int)protocol_handler->send_data(client, data, length);
+            if (send_result < 0) {
+                LOG_ERR("Failed to send data to client fd: %d, close conn.", client.socket_info.sock_fd);
+                close_client_connection(&client.socket_info);
+                return false;
+            }
+        } else if (type == BlockType::Final) {
+            if (client.send_len == 0) {
+                LOG_INFO("Connection closed for client fd: %d", client.socket_info.sock_fd);
+                close_client_connection(&client.socket_info);
+                return false;
+            } else {
+                client.pending_close = true;
+            }
+        }
+    }
+    return true;
 }
 
 void Server::network_thread_func() {
-    if (dll_functions_->handle_init && dll_functions_->handle_init(saved_argc_, saved_argv_, (int) ThreadType::CONN) != 0) {
+    if (!attach_handlers(ThreadType::CONN)) {
         LOG_ERR("Network thread handle_init failed.");
         return;
     }
     
-    while (!stop_flag_.load(std::memory_order_acquire)) {
-        // 1. Wait for the network event, wait maximum for 100 milliseconds
-        dispatcher_->wait_and_handle_events(100, [this](int fd, bool is_readable) {
-            handle_client_data(fd, is_readable);
-        });
+    std::vector<QueueSpan> batch_spans(queue_batch_);
+    std::vector<QueueBlock> batch_blocks(queue_batch_);
 
-        char buffer[DEFAULT_MAX_PACKET_SIZE];
-        QueueBlock block;
-        size_t actual_length;
+    time_t last_stats_time = time(nullptr);
+    while (!stop_flag_.load(std::memory_order_acquire)) {
+        // Move to a reloaded handler between rounds
+        refresh_handlers();
 
-        // 2. Pop data from the send queue to send to clients
-        if (send_queue_.wait_and_pop(buffer, sizeof(buffer), actual_length, block, std::chrono::milliseconds(100))) {
-            ClientInfo* client = client_manager_.get_client(block.socket_info.sock_fd);
-            if (!client) {
-                LOG_TRACE("Failed to get client fd: %d", block.socket_info.sock_fd);
-                continue;
+        // 1. Wait for the network event or a queued response, wait maximum for 100 milliseconds
+        int wait_milliseconds = send_queue_->prepare_wait() ? 100 : 0;
+        dispatcher_->wait_and_handle_events(wait_milliseconds, [this](int fd, bool is_readable) {
+            if (fd == wake_pipe_[0]) {
+                char drain[64];
+                while (read(fd, drain, sizeof(drain)) > 0) {
+                }
+                return;
             }
+            handle_client_data(fd, is_readable);
+        });
+        send_queue_->finish_wait();
 
-            ProtocolHandler* protocol_handler = get_protocol_handler(client->flag);
-            if (protocol_handler) {
-                if (block.type == BlockType::Data) {
-                    int send_result = (int)protocol_handler->send_data(*client, buffer, actual_length);
-                    if (send_result < 0) {
-                        LOG_ERR("Failed to send data to client fd: %d, close conn.", block.socket_info.sock_fd);
-                        close_client_connection(&client->socket_info);
-                    }
-                } else if (block.type == BlockType::Final) {
-                    if (client->send_len == 0) {
-                        LOG_INFO("Connection closed for client fd: %d", block.socket_info.sock_fd);
-                        close_client_connection(&client->socket_info);
-                    } else {
-                        client->pending_close = true;
-                    }
+        // 2. Send responses to clients straight from the send queue, draining it in batches
+        size_t count = send_queue_->peek_batch(batch_spans.data(), batch_blocks.data(), batch_spans.size(),
+                                              std::chrono::milliseconds(0));
+        while (count > 0) {
+            for (size_t i = 0; i < count; ++i) {
+                // Parts of a streamed response are out of line too, unless the queue is shared
+                if (batch_blocks[i].type == BlockType::Indirect ||
+                    (batch_blocks[i].type == BlockType::Chunk && !send_queue_->is_shared())) {
+                    PayloadRef ref = payload_ref(batch_spans[i].data);
+                    deliver_in_order(ref.data(), ref.length, batch_blocks[i], ref.payload);
+                    ref.payload->release();
+                } else {
+                    deliver_in_order(batch_spans[i].data, batch_spans[i].length, batch_blocks[i], nullptr);
                 }
+                send_queue_->release(batch_spans[i]);
             }
+            count = send_queue_->peek_batch(batch_spans.data(), batch_blocks.data(), batch_spans.size(),
+                                           std::chrono::milliseconds(0));
         }
 
         // 3. Check for any pending closures client connections
         for (auto& client_pair : client_manager_.get_all_clients()) {
             ClientInfo& client = client_pair.second;
+
+            // A worker could not queue one of the connection's responses, the later ones would wait forever
+            if (!client.pending_close && connection_table_->response_dropped(client.socket_info.sock_fd, client.generation)) {
+                LOG_ERR("A response of client fd: %d was dropped, close it.", client.socket_info.sock_fd);
+                client.send_len = 0;
+                client.pending_close = true;
+            }
             
             // Send remaining data
             ProtocolHandler* protocol_handler = get_protocol_handler(client.flag);
@@ -241,60 +956,668 @@ void Server::network_thread_func() {
                 close_client_connection(&client.socket_info);
             }
         }
+
+        // 4. Report connection memory usage periodically
+        time_t now = time(nullptr);
+        if (stats_interval_ > 0 && now - last_stats_time >= stats_interval_) {
+            client_manager_.log_memory_usage();
+            size_t queue_bytes = send_queue_->resident_bytes();
+            for (auto& recv_queue : recv_queues_) {
+                queue_bytes += recv_queue->resident_bytes();
+            }
+            LOG_INFO("Ring queues: %zu bytes resident.", queue_bytes);
+            if (dispatch_mode_ == DispatchMode::STEALING) {
+                LOG_INFO("Work stealing: %llu blocks stolen.", (unsigned long long)stolen_blocks_.load(std::memory_order_relaxed));
+            }
+            bool deadlines = request_budget_ > 0;
+            for (size_t module = 0; module < handlers_.size(); ++module) {
+                deadlines = deadlines || handler(module)->handle_input_deadline;
+            }
+            if (deadlines) {
+                LOG_INFO("Deadlines: %llu requests (%llu bytes) skipped after expiring in the queue, %llu answered late.",
+                         (unsigned long long)deadline_stats_->expired.load(std::memory_order_relaxed),
+                         (unsigned long long)deadline_stats_->expired_bytes.load(std::memory_order_relaxed),
+                         (unsigned long long)deadline_stats_->late.load(std::memory_order_relaxed));
+            }
+            uint64_t requests = copy_stats_->requests.load(std::memory_order_relaxed);
+            uint64_t responses = copy_stats_->responses.load(std::memory_order_relaxed);
+            LOG_INFO("Copies: %llu requests (%llu received in place), %.2f copies and %.0f bytes moved per request; "
+                     "%llu responses, %.2f copies and %.0f bytes moved per response.",
+                     (unsigned long long)requests,
+                     (unsigned long long)copy_stats_->requests_in_place.load(std::memory_order_relaxed),
+                     (double)copy_stats_->request_copies.load(std::memory_order_relaxed) / std::max<uint64_t>(requests, 1),
+                     (double)copy_stats_->request_bytes.load(std::memory_order_relaxed) / std::max<uint64_t>(requests, 1),
+                     (unsigned long long)responses,
+                     (double)copy_stats_->response_copies.load(std::memory_order_relaxed) / std::max<uint64_t>(responses, 1),
+                     (double)copy_stats_->response_bytes.load(std::memory_order_relaxed) / std::max<uint64_t>(responses, 1));
+            last_stats_time = now;
+        }
     }
     
-    if (dll_functions_->handle_fini) {
-        dll_functions_->handle_fini((int) ThreadType::CONN);
-    }
+    detach_handlers();
 }
 
 void Server::worker_thread_func(int worker_id) {
-    if (dll_functions_->handle_init && dll_functions_->handle_init(saved_argc_, saved_argv_, (int) ThreadType::WORK) != 0) {
+    if (!attach_handlers(ThreadType::WORK, worker_id)) {
         LOG_ERR("Work thread handle_init failed.");
         return;
     }
     
+    if (dispatch_mode_ == DispatchMode::STEALING) {
+        stealing_worker_loop(worker_id);
+    } else {
+        RingQueue& recv_queue = worker_queue(worker_id);
+        ResponseBatch responses(*send_queue_, connection_table_.get(), copy_stats_);
+        OutputStream output(*send_queue_);
+        t_output = &output;
+        QueueDelayController codel(codel_target_, codel_interval_);
+        std::vector<QueueSpan> local_spans(queue_batch_);
+        std::vector<QueueBlock> local_blocks(queue_batch_);
+        HandlerBatch handler_batch;
+
+        // A worker process claims into its journal, so the supervisor can recover the batch if it dies
+        WorkerJournal* journal = journals_ ? &journals_[worker_id] : nullptr;
+        QueueSpan* spans = journal ? journal->spans : local_spans.data();
+        QueueBlock* blocks = journal ? journal->blocks : local_blocks.data();
+
+        while (!stop_flag_.load(std::memory_order_acquire)) {
+            // Move to a reloaded handler between batches
+            refresh_handlers();
+
+            // Resume the requests waiting on the tasks that are due
+            tasks_.run_ready(task_batch_);
+
+            // Claim a batch of requests and let the handler read them inside the queue. The previous
+            // batch is done; until count records the new one, the journal's intent describes it.
+            if (journal) {
+                journal->count.store(0, std::memory_order_release);
+                journal->done.store(0, std::memory_order_release);
+            }
+            size_t count = recv_queue.peek_batch(spans, blocks, queue_batch_, tasks_.wait_time(std::chrono::milliseconds(100)),
+                                                 journal ? &journal->intent : nullptr);
+            if (journal) {
+                journal->count.store(count, std::memory_order_release);
+                journal->intent.start.store(NO_CLAIM, std::memory_order_release);
+            }
+            if (batch_handlers(handlers_.size())) {
+                // The whole batch stays claimed until its responses are queued, a worker process dying
+                // in the batch handler has all of it recovered by the supervisor. Each run of requests
+                // for one handler module goes to that module.
+                for (size_t start = 0, end = 0; start < count; start = end) {
+                    size_t module = connection_table_->module(blocks[start].connection);
+                    for (end = start + 1; end < count && connection_table_->module(blocks[end].connection) == module; ++end) {
+                    }
+                    process_batch(spans + start, blocks + start, end - start, responses, codel, handler_batch, module);
+                }
+                responses.flush();
+                for (size_t i = 0; i < count; ++i) {
+                    recv_queue.release(spans[i]);
+                }
+                if (journal) {
+                    journal->done.store(count, std::memory_order_release);
+                }
+                continue;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                process_block(spans[i], blocks[i], responses, codel);
+                if (journal) {
+                    // A response still in the batch would die with this process
+                    responses.flush();
+                }
+                recv_queue.release(spans[i]);
+                if (journal) {
+                    journal->done.store(i + 1, std::memory_order_release);
+                }
+            }
+
+            // Push the batch's responses together
+            responses.flush();
+        }
+        t_output = nullptr;
+    }
+
+    detach_handlers();
+}
+
+// True if no later block of a stolen batch belongs to the same connection as block `index`
+static bool last_of_connection(const QueueBlock* blocks, size_t index, size_t count) {
+    for (size_t i = index + 1; i < count; ++i) {
+        if (blocks[i].connection == blocks[index].connection && blocks[i].generation == blocks[index].generation) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Worker loop in stealing mode: serve the own queue first, then steal from the busiest peer
+void Server::stealing_worker_loop(int worker_id) {
+    InflightGuard guard(connection_table_.get());
+    ResponseBatch responses(*send_queue_, connection_table_.get(), copy_stats_);
+    OutputStream output(*send_queue_);
+    t_output = &output;
+    QueueDelayController codel(codel_target_, codel_interval_);
+    RingQueue& own_queue = *recv_queues_[worker_id];
+    QueueSpan span;
+    QueueBlock block;
+    std::vector<QueueSpan> spans(steal_batch_);
+    std::vector<QueueBlock> blocks(spans.size());
+
     while (!stop_flag_.load(std::memory_order_acquire)) {
-        char buffer[DEFAULT_MAX_PACKET_SIZE];
-        QueueBlock block;
-        size_t actual_length;
+        refresh_handlers();
+        tasks_.run_ready(task_batch_);
 
-        // Pop data from the receive queue to process
-        if (recv_queue_.wait_and_pop(buffer, sizeof(buffer), actual_length, block, std::chrono::milliseconds(100))) {
-            char send_buffer[DEFAULT_MAX_PACKET_SIZE];
-            char* send_data = send_buffer;
-            int send_data_len = 0;
-            int result = dll_functions_->handle_message_from_client(buffer, (int)actual_length, &send_data, &send_data_len, &block.socket_info);
+        if (own_queue.try_peek(span, block, &guard)) {
+            process_block(span, block, responses, codel);
+            own_queue.release(span);
+            responses.flush();  // The response must be queued before another worker may take the connection
+            guard.release(block);
+            continue;
+        }
 
-            if (result >= 0 && send_data != nullptr) {
-                QueueBlock response_block;
-                response_block.accept_fd = block.accept_fd;
-                response_block.socket_info = block.socket_info;
-                response_block.type = BlockType::Data;
-                response_block.total_length = send_data_len + sizeof(QueueBlock);
+        // Own queue is empty or its head belongs to a connection busy elsewhere
+        RingQueue* victim = nullptr;
+        size_t victim_size = 0;
+        for (size_t i = 0; i < recv_queues_.size(); ++i) {
+            size_t queued = recv_queues_[i]->size();
+            if ((int)i != worker_id && queued > victim_size) {
+                victim = recv_queues_[i].get();
+                victim_size = queued;
+            }
+        }
 
-                // Push processed data to the send queue
-                send_queue_.push(send_data, send_data_len, response_block);
-                LOG_TRACE("Processed data for client fd: %d", block.socket_info.sock_fd);
+        // Take a batch of the victim's oldest blocks with one claim
+        size_t stolen = victim ? victim->try_peek_batch(spans.data(), blocks.data(), spans.size(), &guard) : 0;
+        for (size_t i = 0; i < stolen; ++i) {
+            process_block(spans[i], blocks[i], responses, codel);
+            victim->release(spans[i]);
+            if (last_of_connection(blocks.data(), i, stolen)) {
+                responses.flush();  // The response must be queued before another worker may take the connection
+                guard.release(blocks[i]);
             }
+        }
+        if (stolen > 0) {
+            stolen_blocks_.fetch_add(stolen, std::memory_order_relaxed);
+            continue;
+        }
+
+        // Nothing to steal: nap briefly if peers are backlogged, otherwise park on the own queue
+        own_queue.wait_for_data(tasks_.wait_time(std::chrono::milliseconds(victim ? 1 : 100)));
+    }
+    t_output = nullptr;
+}
+
+ResponseBatch::ResponseBatch(RingQueue& send_queue, ConnectionTable* connections, CopyStats* copies)
+    : send_queue_(send_queue), connections_(connections), copies_(copies), blocks_(send_queue), arena_(std::max(DEFAULT_QUEUE_BATCH_BUFFER, 2 * DEFAULT_INLINE_PAYLOAD)), used_(0) {
+}
 
-            if (result < 0) {
-                QueueBlock final_block;
-                final_block.accept_fd = block.accept_fd;
-                final_block.socket_info = block.socket_info;
-                final_block.type = BlockType::Final;
-                final_block.total_length = sizeof(QueueBlock);
-                send_queue_.push(nullptr, 0, final_block);
-                LOG_WARN("Error processing data, pushing final block for fd: %d", block.socket_info.sock_fd);
+char* ResponseBatch::reserve(size_t length) {
+    size_t space = std::max(length, (size_t)DEFAULT_INLINE_PAYLOAD);
+    if (arena_.size() - used_ < space || blocks_.size() == QUEUE_BATCH_CAPACITY) {
+        flush();
+        // Nothing points into the arena after a flush, it may move
+        if (arena_.size() < space) {
+            arena_.resize(space);
+        }
+    }
+    return arena_.data() + used_;
+}
+
+void ResponseBatch::add(const char* data, size_t length, const QueueBlock& block_header, Payload* request_payload) {
+    if (copies_) {
+        copies_->responses.fetch_add(1, std::memory_order_relaxed);
+    }
+    // A payload pointer means nothing to another process, a shared queue carries every response inline
+    if (length > (size_t)DEFAULT_INLINE_PAYLOAD && !send_queue_.is_shared()) {
+        // Too large for the send queue, queue it by reference after the responses before it
+        flush();
+        Payload* payload = request_payload;
+        size_t offset = 0;
+        if (payload && payload->contains(data, length)) {
+            // The response is part of the request, share it instead of copying
+            payload->add_ref();
+            offset = data - payload->data();
+        } else {
+            payload = Payload::create(length);
+            if (!payload) {
+                drop(block_header);
+                return;
             }
+            std::memcpy(payload->data(), data, length);
+            count_copy(length);
+        }
+        if (!push_payload(send_queue_, payload, offset, length, block_header)) {
+            drop(block_header);
         }
+    } else if (data == arena_.data() + used_) {
+        // Written in place by the handler, queue it with the rest of the batch
+        if (!blocks_.add(data, length, block_header)) {
+            drop(block_header);
+            return;
+        }
+        count_copy(length);
+        used_ += length;
+    } else if (data == nullptr) {
+        if (!blocks_.add(nullptr, 0, block_header)) {
+            drop(block_header);
+        }
+    } else {
+        // The handler answered from its own memory, which may not outlive this call
+        flush();
+        if (!send_queue_.push(data, length, block_header)) {
+            drop(block_header);
+            return;
+        }
+        count_copy(length);
     }
-    
-    if (dll_functions_->handle_fini) {
-        dll_functions_->handle_fini((int) ThreadType::WORK);
+}
+
+void ResponseBatch::count_copy(size_t length) {
+    if (copies_) {
+        copies_->count_response_copy(length);
+    }
+}
+
+void ResponseBatch::flush() {
+    blocks_.flush();
+    // The rest of the batch points into the arena, which is reused from here on
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+        drop(blocks_.header(i));
+    }
+    blocks_.clear();
+    used_ = 0;
+}
+
+void ResponseBatch::drop(const QueueBlock& block_header) {
+    LOG_ERR("Failed to queue response %u for client fd: %u, dropped.", block_header.sequence, block_header.connection);
+    if (connections_) {
+        connections_->drop_response(block_header.connection, block_header.generation);
     }
 }
 
+RequestAction Server::request_action(const QueueBlock& block, QueueDelayController& codel) {
+    RequestAction action = RequestAction::PROCESS;
+    if (codel.enabled() || block.budget > 0) {
+        uint32_t now = queue_clock();
+        if (codel.enabled() && codel.should_shed(now - block.timestamp, now)) {
+            action = RequestAction::SHED;
+        }
+        // The client gave up on a request that waited out its budget, running the handler would be wasted
+        if (block.budget > 0 && now - block.timestamp >= block.budget) {
+            action = RequestAction::EXPIRE;
+        }
+    }
+    return action;
+}
+
+// Resolve an out-of-line request, then process, shed or skip it
+void Server::process_block(const QueueSpan& span, const QueueBlock& block, ResponseBatch& responses, QueueDelayController& codel) {
+    process_block(span, block, responses, request_action(block, codel));
+}
+
+void Server::process_block(const QueueSpan& span, const QueueBlock& block, ResponseBatch& responses, RequestAction action) {
+    if (block.type == BlockType::Indirect) {
+        PayloadRef ref = payload_ref(span.data);
+        process_message(ref.data(), ref.length, block, responses, ref.payload, action);
+        ref.payload->release();
+    } else {
+        process_message(span.data, span.length, block, responses, nullptr, action);
+    }
+}
+
+// Hand a request to the handler and queue its response. A shed request is
+// answered by the handler's fast-fail hook, or dropped without a response,
+// an expired one is dropped without a response.
+void Server::process_message(const char* data, size_t length, const QueueBlock& block, ResponseBatch& responses,
+                             Payload* request_payload, RequestAction action) {
+    // Nobody is waiting for the response of a connection that was closed meanwhile
+    if (!connection_table_->is_current(block.connection, block.generation)) {
+        LOG_TRACE("Skip request of closed client fd: %u", block.connection);
+        return;
+    }
+
+    // An echo of the request always fits the response space
+    char* send_buffer = responses.reserve(length);
+    char* send_data = send_buffer;
+    int send_data_len = 0;
+    // The handler reads the connection's metadata straight from the connection table
+    const SocketInfo* socket_info = connection_table_->socket_info(block.connection);
+    size_t module = connection_table_->module(block.connection);
+    dll_func_t* functions = handler(module);
+    t_running = t_handlers[module].version;
+    int result = 0;
+    t_request_start = block.timestamp;
+    t_request_budget = block.budget;
+    t_request_handle.connection = block.connection;
+    t_request_handle.sequence = block.sequence;
+    t_request_handle.generation = block.generation;
+    if (action == RequestAction::PROCESS) {
+        OutputStream* output = t_output;
+        if (output) {
+            output->begin(block, responses);
+        }
+        result = call_message_from_client(functions, &t_handlers[module].thread, data, (int)length, &send_data, &send_data_len, socket_info);
+        if (block.budget > 0 && result != HANDLER_DEFERRED && server_request_budget() == 0) {
+            deadline_stats_->late.fetch_add(1, std::memory_order_relaxed);
+        }
+        // A handler that streamed its output completes the response through the stream, send_data is
+        // appended to it. A failed or deferred one has its parts sent before the usual answer.
+        if (output && output->used()) {
+            bool last = result >= 0 && result != HANDLER_DEFERRED;
+            if (last && send_data && send_data_len > 0) {
+                output->write(send_data, send_data_len);
+            }
+            if (output->finish(last) && last) {
+                t_request_budget = 0;
+                return;
+            }
+            if (last) {
+                LOG_ERR("Failed to queue the streamed response of client fd: %u", block.connection);
+                result = -1;
+            }
+        } else if (output) {
+            output->finish(false);
+        }
+    } else if (action == RequestAction::SHED && functions->handle_overload) {
+        result = functions->handle_overload(data, (int)length, &send_data, &send_data_len, socket_info);
+    } else {
+        if (action == RequestAction::EXPIRE) {
+            deadline_stats_->expired.fetch_add(1, std::memory_order_relaxed);
+            deadline_stats_->expired_bytes.fetch_add(length, std::memory_order_relaxed);
+            LOG_TRACE("Skip expired request %u of client fd: %u", block.sequence, block.connection);
+        }
+        send_data = nullptr;
+    }
+    t_request_budget = 0;
+
+    queue_response(block, result, send_data, send_data_len, responses, request_payload);
+}
+
+// Hand the requests of a popped batch to handle_message_batch together. Shed,
+// expired and stale requests are answered one by one as usual.
+void Server::process_batch(const QueueSpan* spans, const QueueBlock* blocks, size_t count, ResponseBatch& responses,
+                           QueueDelayController& codel, HandlerBatch& batch, size_t module) {
+    dll_func_t* functions = handler(module);
+    if (!has_message_batch(functions)) {
+        for (size_t i = 0; i < count; ++i) {
+            process_block(spans[i], blocks[i], responses, codel);
+        }
+        return;
+    }
+
+    batch.messages.clear();
+    batch.indices.clear();
+    batch.payloads.clear();
+    batch.offsets.clear();
+    size_t space = 0;
+    uint32_t now = queue_clock();
+    t_request_budget = 0;
+    for (size_t i = 0; i < count; ++i) {
+        RequestAction action = request_action(blocks[i], codel);
+        if (action != RequestAction::PROCESS || !connection_table_->is_current(blocks[i].connection, blocks[i].generation)) {
+            process_block(spans[i], blocks[i], responses, action);
+            continue;
+        }
+
+        batch_message_t message;
+        Payload* payload = nullptr;
+        if (blocks[i].type == BlockType::Indirect) {
+            PayloadRef ref = payload_ref(spans[i].data);
+            message.recv_data = ref.data();
+            message.recv_data_len = (int)ref.length;
+            payload = ref.payload;
+        } else {
+            message.recv_data = spans[i].data;
+            message.recv_data_len = (int)spans[i].length;
+        }
+        message.si = connection_table_->socket_info(blocks[i].connection);
+        message.send_data = nullptr;  // Set once every message's space is known
+        message.send_data_len = 0;
+        message.result = 0;
+        message.handle.connection = blocks[i].connection;
+        message.handle.sequence = blocks[i].sequence;
+        message.handle.generation = blocks[i].generation;
+        batch.messages.push_back(message);
+        batch.indices.push_back(i);
+        batch.payloads.push_back(payload);
+        batch.offsets.push_back(space);
+        space += std::max(message.recv_data_len, DEFAULT_INLINE_PAYLOAD);
+
+        // The batch runs against its most urgent deadline
+        const QueueBlock& block = blocks[i];
+        if (block.budget > 0 && (t_request_budget == 0 ||
+            block.budget - (now - block.timestamp) < t_request_budget - (now - t_request_start))) {
+            t_request_start = block.timestamp;
+            t_request_budget = block.budget;
+        }
+    }
+
+    batch.buffers.resize(space);
+    for (size_t k = 0; k < batch.messages.size(); ++k) {
+        batch.messages[k].send_data = batch.buffers.data() + batch.offsets[k];
+    }
+
+    t_running = t_handlers[module].version;
+    if (!batch.messages.empty() &&
+        call_message_batch(functions, &t_handlers[module].thread, batch.messages.data(), (int)batch.messages.size()) < 0) {
+        // The handler declined the batch, run it message by message
+        for (size_t k = 0; k < batch.messages.size(); ++k) {
+            const batch_message_t& message = batch.messages[k];
+            process_message(message.recv_data, message.recv_data_len, blocks[batch.indices[k]], responses,
+                            batch.payloads[k], RequestAction::PROCESS);
+        }
+    } else {
+        now = queue_clock();
+        for (size_t k = 0; k < batch.messages.size(); ++k) {
+            batch_message_t& message = batch.messages[k];
+            const QueueBlock& block = blocks[batch.indices[k]];
+            if (block.budget > 0 && message.result != HANDLER_DEFERRED && now - block.timestamp >= block.budget) {
+                deadline_stats_->late.fetch_add(1, std::memory_order_relaxed);
+            }
+            // Responses written to the batch buffers join the worker's response batch
+            char* send_data = message.send_data;
+            if (send_data && message.send_data_len > 0 && message.send_data_len <= DEFAULT_INLINE_PAYLOAD) {
+                send_data = responses.reserve(message.send_data_len);
+                std::memcpy(send_data, message.send_data, message.send_data_len);
+            }
+            queue_response(block, message.result, send_data, message.send_data_len, responses, batch.payloads[k]);
+        }
+    }
+    t_request_budget = 0;
+
+    for (Payload* payload : batch.payloads) {
+        if (payload) {
+            payload->release();
+        }
+    }
+}
+
+// Queue the response of a processed request, a failed one closes the connection
+void Server::queue_response(const QueueBlock& block, int result, char* send_data, int send_data_len,
+                           ResponseBatch& responses, Payload* request_payload) {
+    // The handler answers through server_reply later
+    if (result == HANDLER_DEFERRED) {
+        request_handle_t handle;
+        handle.connection = block.connection;
+        handle.sequence = block.sequence;
+        handle.generation = block.generation;
+        hold_deferred(handle);
+        LOG_TRACE("Deferred request %u of client fd: %u", block.sequence, block.connection);
+        return;
+    }
+
+    if (result >= 0) {
+        // Every request answers with one block, an empty one if there is no response, so the
+        // network thread can release the connection's responses in request order
+        if (send_data == nullptr) {
+            send_data_len = 0;
+        }
+        QueueBlock response_block;
+        response_block.connection = block.connection;
+        response_block.sequence = block.sequence;
+        response_block.generation = block.generation;
+        response_block.timestamp = block.timestamp;
+        response_block.budget = block.budget;
+        response_block.lane = 0;
+        response_block.type = BlockType::Data;
+        response_block.total_length = send_data_len + sizeof(QueueBlock);
+
+        // Queue processed data for the send queue
+        responses.add(send_data_len > 0 ? send_data : nullptr, send_data_len, response_block, request_payload);
+        LOG_TRACE("Processed data for client fd: %u", block.connection);
+    }
+
+    if (result < 0) {
+        QueueBlock final_block;
+        final_block.connection = block.connection;
+        final_block.sequence = block.sequence;
+        final_block.generation = block.generation;
+        final_block.timestamp = block.timestamp;
+        final_block.budget = block.budget;
+        final_block.lane = 0;
+        final_block.type = BlockType::Final;
+        final_block.total_length = sizeof(QueueBlock);
+        responses.add(nullptr, 0, final_block, nullptr);
+        LOG_WARN("Error processing data, pushing final block for fd: %u", block.connection);
+    }
+}
+
+void Server::post_task(TaskQueue::TaskFunc fn, void* arg, int delay_ms) {
+    tasks_.post(fn, arg, delay_ms);
+    for (auto& recv_queue : recv_queues_) {
+        recv_queue->wake(num_workers_);
+    }
+}
+
+bool Server::attach_handlers(ThreadType type, int worker_id) {
+    for (size_t module = 0; module < handlers_.size(); ++module) {
+        HandlerSlot& slot = t_handlers[module];
+        slot.thread.thread_type = (int) type;
+        slot.thread.worker_id = worker_id;
+        handlers_[module]->attach(slot);
+        if (!handlers_[module]->init_thread(slot)) {
+            LOG_ERR("Handler module %zu handle_init failed on thread type %d.", module, (int) type);
+            handlers_[module]->detach(slot);
+            while (module-- > 0) {
+                HandlerRegistry::fini_thread(t_handlers[module]);
+                handlers_[module]->detach(t_handlers[module]);
+            }
+            return false;
+        }
+    }
+    return true;
+}
+
+void Server::refresh_handlers() {
+    for (size_t module = 0; module < handlers_.size(); ++module) {
+        handlers_[module]->refresh(t_handlers[module]);
+    }
+}
+
+void Server::detach_handlers() {
+    for (size_t module = 0; module < handlers_.size(); ++module) {
+        HandlerRegistry::fini_thread(t_handlers[module]);
+        handlers_[module]->detach(t_handlers[module]);
+    }
+}
+
+void Server::reload_handlers() {
+    for (auto& handlers : handlers_) {
+        std::string path = handlers->path();
+        if (path.empty()) {
+            LOG_WARN("The handler linked into the server cannot be reloaded.");
+            continue;
+        }
+        handlers->reload(path.c_str());
+    }
+}
+
+void Server::run_handler_timers(int elapsed_milliseconds) {
+    for (size_t module = 0; module < handlers_.size(); ++module) {
+        if (handler(module)->handle_timer) {
+            int elapsed = elapsed_milliseconds;
+            handler(module)->handle_timer(&elapsed);
+        }
+    }
+}
+
+void Server::hold_deferred(const request_handle_t& handle) {
+    if (!t_running) {
+        return;
+    }
+    HandlerRegistry::add_ref(t_running);
+    std::lock_guard<std::mutex> lock(deferred_mutex_);
+    auto inserted = deferred_versions_.emplace(std::make_tuple(handle.connection, handle.sequence, handle.generation), t_running);
+    if (!inserted.second) {
+        HandlerRegistry::release(t_running);
+    }
+}
+
+void Server::release_deferred(const request_handle_t& handle) {
+    HandlerVersion* version = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(deferred_mutex_);
+        auto it = deferred_versions_.find(std::make_tuple(handle.connection, handle.sequence, handle.generation));
+        if (it == deferred_versions_.end()) {
+            return;
+        }
+        version = it->second;
+        deferred_versions_.erase(it);
+    }
+    HandlerRegistry::release(version);
+}
+
+bool Server::post_response(const request_handle_t& handle, const char* data, size_t length, BlockType type) {
+    if (!queue_reply(handle, data, length, type)) {
+        return false;
+    }
+    // The request is answered, the handler version it started on may be unloaded
+    if (type != BlockType::Chunk) {
+        release_deferred(handle);
+    }
+    return true;
+}
+
+bool Server::queue_reply(const request_handle_t& handle, const char* data, size_t length, BlockType type) {
+    QueueBlock response_block;
+    response_block.connection = handle.connection;
+    response_block.sequence = handle.sequence;
+    response_block.generation = handle.generation;
+    response_block.timestamp = queue_clock();
+    response_block.budget = 0;
+    response_block.lane = 0;
+    response_block.type = type;
+    response_block.total_length = length + sizeof(QueueBlock);
+
+    // Every path below copies the reply once, into a payload or into the send queue
+    if (type != BlockType::Chunk) {
+        copy_stats_->responses.fetch_add(1, std::memory_order_relaxed);
+    }
+    copy_stats_->count_response_copy(length);
+
+    // A part is queued like the parts of an output stream
+    if (type == BlockType::Chunk) {
+        Payload* payload = length <= (size_t)DEFAULT_OUTPUT_CHUNK ? Payload::create_chunk() : Payload::create(length);
+        if (!payload) {
+            return false;
+        }
+        std::memcpy(payload->data(), data, length);
+        bool queued = push_output(*send_queue_, response_block, payload, 0, length, false);
+        payload->release();
+        return queued;
+    }
+
+    // The caller's data may not outlive this call, a large response is copied out of line
+    if (length > (size_t)DEFAULT_INLINE_PAYLOAD && !send_queue_->is_shared()) {
+        Payload* payload = Payload::create(length);
+        if (!payload) {
+            return false;
+        }
+        std::memcpy(payload->data(), data, length);
+        return push_payload(*send_queue_, payload, 0, length, response_block);
+    }
+    return send_queue_->push(data, length, response_block);
+}
+
 // Handle client data, including accepting new connections for TCP
 void Server::handle_client_data(int fd, bool is_readable) {
     // Check if it's a server socket (for new connections)
@@ -303,7 +1626,16 @@ void Server::handle_client_data(int fd, bool is_readable) {
         // Use appropriate protocol handler to manage the connection
         ProtocolHandler* protocol_handler = get_protocol_handler(bind_info_it->second.flags);
         if (protocol_handler) {
-            protocol_handler->accept_client(fd, client_manager_, dispatcher_, dll_functions_, recv_buffer_size_, send_buffer_size_);
+            const BindInfo& bind_info = bind_info_it->second;
+            ClientInfo* client = protocol_handler->accept_client(fd, client_manager_, dispatcher_, handler(bind_info.module));
+            if (client) {
+                client->lane = bind_info.lane;
+                client->recv_lane = bind_info.lane;
+                client->ordered = bind_info.ordered;
+                client->module = bind_info.module;
+                client->budget = request_budget_;
+                client->generation = connection_table_->open(client->socket_info, bind_info.ordered, bind_info.module);
+            }
         } else {
             LOG_CRIT("Unsupported protocol for socket fd: %d", fd);
         }
@@ -319,7 +1651,13 @@ void Server::handle_client_data(int fd, bool is_readable) {
 
     ProtocolHandler* protocol_handler = get_protocol_handler(client->flag);
     if (protocol_handler && is_readable) {
-        int recv_result = (int) protocol_handler->receive_data(*client, dll_functions_, recv_queue_);
+        // Handlers see when the connection last delivered data
+        client->socket_info.recv_timestamp = time(nullptr);
+        ConnectionSlot* slot = connection_table_->get(fd);
+        if (slot && slot->generation.load(std::memory_order_relaxed) == client->generation) {
+            slot->socket_info.recv_timestamp = client->socket_info.recv_timestamp;
+        }
+        int recv_result = (int) protocol_handler->receive_data(*client, handler(client->module), &t_handlers[client->module].thread, select_recv_queue(*client));
         if (recv_result < 0) {
             LOG_ERR("Failed to receive data from client fd: %d, close connection.", fd);
             close_client_connection(&client->socket_info);
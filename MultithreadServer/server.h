@@ -2,16 +2,63 @@
 #define SERVER_H
 
 #include <atomic>
+#include <map>
+#include <mutex>
 #include <thread>
+#include <tuple>
 #include <vector>
+#include <memory>
 #include <unordered_map>
 #include <netinet/in.h>
+#include <sys/types.h>
 #include "ring_queue.h"
 #include "client_manager.h"
 #include "event_dispatcher.h"
 #include "dll_functions.h"
 #include "log_manager.h"
 #include "protocol_handler.h"
+#include "connection_table.h"
+#include "payload.h"
+#include "queue_delay.h"
+#include "task_queue.h"
+#include "output_stream.h"
+#include "handler_registry.h"
+
+// Microseconds left until the deadline of the request the calling worker thread
+// is processing, 0 once it passed and -1 if the request has none. Handlers reach
+// it through the server API.
+extern "C" int server_request_budget();
+
+// Handle of the request the calling worker thread is processing, for a handler
+// that returns HANDLER_DEFERRED and replies later
+extern "C" request_handle_t server_request_handle();
+
+// Answer a deferred request from any thread, returns -1 if the send queue is
+// full. Every deferred request must be answered by one of them, the
+// connection's later responses wait for it.
+extern "C" int server_reply(request_handle_t handle, const char* data, int len);
+// Close the connection of a deferred request once the responses before it are sent
+extern "C" int server_close(request_handle_t handle);
+
+// Queue a part of the response to a deferred request from any thread, the
+// request is completed later by server_reply() or server_close()
+extern "C" int server_reply_part(request_handle_t handle, const char* data, int len);
+
+// Stream the response of the request the calling worker thread is processing
+// instead of filling send_data: reserve space of at least `min_len` bytes, write
+// into it and commit what was written, or write a copy. Full chunks are sent
+// while the handler keeps writing, flush sends what was written so far. Once
+// the handler returns, its send_data is appended and the response completed.
+// Return -1 (nullptr) outside handle_message_from_client.
+extern "C" char* server_output_reserve(int min_len, int* available);
+extern "C" int server_output_commit(int len);
+extern "C" int server_output_write(const char* data, int len);
+extern "C" int server_output_flush();
+
+// Run fn(arg) on a worker thread of the calling process, right away or after
+// `milliseconds`. Callable from any thread, returns -1 if the server is not running.
+extern "C" int server_post(void (*fn)(void*), void* arg);
+extern "C" int server_post_after(int milliseconds, void (*fn)(void*), void* arg);
 
 enum class ThreadType {
     MAIN = 0,
@@ -19,17 +66,96 @@ enum class ThreadType {
     WORK
 };
 
+enum class DispatchMode {
+    SHARED = 0,  // All workers pop from one receive queue
+    AFFINITY,    // Each worker owns a queue, connections are hashed to a worker
+    STEALING     // Like AFFINITY, idle workers steal from the busiest peers
+};
+
+// Blocks a worker process has claimed, so the supervisor can recover them if the worker dies
+struct WorkerJournal {
+    std::atomic<size_t> count;  // Blocks claimed by the last peek
+    std::atomic<size_t> done;   // Blocks of them answered and released
+    ClaimIntent intent;         // The claim of a peek in progress, before count records it
+    QueueSpan spans[QUEUE_BATCH_CAPACITY];
+    QueueBlock blocks[QUEUE_BATCH_CAPACITY];
+};
+
+// Work the workers saved by skipping requests whose client stopped waiting,
+// in shared memory so worker processes count into it too
+struct DeadlineStats {
+    std::atomic<uint64_t> expired;        // Requests skipped because their deadline passed in the queue
+    std::atomic<uint64_t> expired_bytes;  // Request bytes of them the handler did not process
+    std::atomic<uint64_t> late;           // Requests the handler answered after their deadline
+};
+
+// What a worker does with a request it dequeued
+enum class RequestAction {
+    PROCESS = 0,  // Run the handler
+    SHED,         // Overloaded, answer through the handler's fast-fail hook
+    EXPIRE        // The client stopped waiting, answer with an empty response
+};
+
 struct BindInfo {
     std::string ip;
     int port;
     std::string type; // "tcp" or "udp"
     int idle_timeout;
     int flags;
+    bool ordered; // Requests of one connection are processed one at a time
+    uint8_t lane; // Receive queue lane of the connections' requests
+    std::string handler; // Handler library of the listener, empty for the default one
+    uint8_t module; // Index of that library in the server's handler modules
+};
+
+// Responses produced by one worker. The handler writes each response in place
+// in the arena and the batch is pushed to the send queue with one reservation.
+// A response that cannot be queued marks its connection in `connections`, so
+// the network thread closes it instead of holding the later responses forever.
+class ResponseBatch {
+public:
+    // Copies of response bytes are counted into `copies` if set
+    ResponseBatch(RingQueue& send_queue, ConnectionTable* connections, CopyStats* copies);
+
+    // Space for the next response, at least DEFAULT_INLINE_PAYLOAD and `length` bytes
+    char* reserve(size_t length);
+
+    // Queue a response, data written outside the arena is pushed right away.
+    // Large responses are queued by reference, sharing `request_payload` when
+    // the response lies inside it.
+    void add(const char* data, size_t length, const QueueBlock& block_header, Payload* request_payload);
+
+    // Push every queued response
+    void flush();
+
+private:
+    // Log a response that could not be queued and mark its connection
+    void drop(const QueueBlock& block_header);
+
+    // Count a copy of `length` response bytes
+    void count_copy(size_t length);
+
+    RingQueue& send_queue_;
+    ConnectionTable* connections_;
+    CopyStats* copies_;
+    QueueBatch blocks_;
+    std::vector<char> arena_;
+    size_t used_;
+};
+
+// Requests of one popped batch handed to handle_message_batch together
+struct HandlerBatch {
+    std::vector<batch_message_t> messages;
+    std::vector<size_t> indices;     // Position of each message in the popped batch
+    std::vector<Payload*> payloads;  // Out-of-line request of each message, nullptr when inline
+    std::vector<char> buffers;       // Response space of every message
+    std::vector<size_t> offsets;     // Where each message's response space starts in buffers
 };
 
 class Server {
 public:
-    Server(size_t queue_size, int num_workers, dll_func_t* dll_funcs);
+    // `dll_funcs` was loaded from `dll_path`, the handler of the binds that name none
+    Server(size_t queue_size, int num_workers, dll_func_t* dll_funcs, const std::string& dll_path);
     ~Server();
 
     // Start and stop the server
@@ -40,28 +166,77 @@ public:
     void save_argc_argv(int argc, char** argv) {
         saved_argc_ = argc;
         saved_argv_ = argv;
+        for (auto& handlers : handlers_) {
+            handlers->set_args(argc, argv);
+        }
     }
 
+    // Run every handler module's handle_init for the calling thread, false if one fails.
+    // `worker_id` numbers a worker in the handler_thread_t its callbacks receive.
+    bool attach_handlers(ThreadType type, int worker_id = -1);
+    // Move the calling thread to reloaded handler versions, between batches
+    void refresh_handlers();
+    // Run every handler module's handle_fini for the calling thread
+    void detach_handlers();
+    // Reload every handler module from its library, without dropping connections
+    void reload_handlers();
+    // Run every handler module's handle_timer on the calling thread
+    void run_handler_timers(int elapsed_milliseconds);
+
+    // Queue the response to a deferred request, callable from any thread of the
+    // server or a worker process. A Final block closes the connection.
+    bool post_response(const request_handle_t& handle, const char* data, size_t length, BlockType type);
+
+    // Queue a task for the workers of this process and wake them
+    void post_task(TaskQueue::TaskFunc fn, void* arg, int delay_ms);
+
+    // The started server, used by the server API exported to handlers
+    static Server* instance() { return instance_; }
+
 private:
-    RingQueue recv_queue_; // Receive queue (network thread -> worker threads)
-    RingQueue send_queue_; // Send queue (worker threads -> network thread)
+    static Server* instance_;
+    std::vector<std::unique_ptr<RingQueue>> recv_queues_; // Receive queues (network thread -> worker threads), one shared or one per worker
+    std::unique_ptr<RingQueue> send_queue_; // Send queue (worker threads -> network thread)
+    size_t queue_size_; // Maximum size of the receive queue, split across workers in affinity mode
     int num_workers_; // Number of worker threads
+    DispatchMode dispatch_mode_; // How requests are routed to workers
     std::atomic<bool> stop_flag_; // Flag to stop server
     std::thread network_thread_; // Thread handling network events
     std::vector<std::thread> worker_threads_; // Worker threads
+    bool process_mode_; // Workers run in processes forked by a supervisor, queues are shared
+    pid_t supervisor_pid_; // Process restarting crashed workers, -1 in thread mode
+    WorkerJournal* journals_; // One per worker process, in shared memory
     std::vector<int> server_sockets_;  // Handles multiple socket types (TCP/UDP)
     std::unordered_map<int, BindInfo> socket_bind_map_; // Maps socket FD to BindInfo for protocol type
     std::vector<BindInfo> binds_; // Stores parsed bind information
-    dll_func_t* dll_functions_; // DLL function pointers
+    std::vector<std::unique_ptr<HandlerRegistry>> handlers_; // Handler modules, the default one first
+    std::mutex deferred_mutex_;
+    std::map<std::tuple<uint32_t, uint32_t, uint16_t>, HandlerVersion*> deferred_versions_; // Version of each unanswered deferred request
     ClientManager client_manager_; // Manages client connections
+    std::unique_ptr<ConnectionTable> connection_table_; // Per-connection state shared with workers
+    int steal_batch_; // Maximum blocks taken from a peer per steal
+    std::atomic<uint64_t> stolen_blocks_; // Blocks processed by a worker other than the owner
+    int queue_batch_; // Maximum blocks popped from a queue at once
+    int task_batch_; // Maximum posted tasks a worker runs between requests, at least 1
+    size_t max_held_responses_; // Responses of one connection held for an earlier one before it is closed
+    uint32_t codel_target_; // Queue delay in microseconds above which requests are shed, 0 disables
+    uint32_t codel_interval_; // Microseconds the delay may stay above the target before shedding
+    uint32_t request_budget_; // Default request deadline in microseconds from pkg_timeout, 0 for none
+    DeadlineStats* deadline_stats_; // Requests skipped past their deadline, shared with worker processes
+    CopyStats* copy_stats_; // Request and response bytes copied, shared with worker processes
+    TaskQueue tasks_; // Tasks posted by handlers, run by the workers of this process
+    int wake_pipe_[2]; // Wakes the network thread when responses are queued
     EventDispatcher* dispatcher_; // Event dispatcher (epoll/select)
     ssize_t recv_buffer_size_;
     ssize_t send_buffer_size_;
+    int stats_interval_; // Seconds between connection memory reports, 0 disables
     int saved_argc_;
     char** saved_argv_;
 
     // Create and bind server sockets based on configuration
     int create_server_sockets(const std::string& bind_file);
+    // Load the handler libraries the binds name, binds naming the same library share its module
+    int load_bind_handlers();
 
     // Main thread for handling network events
     void network_thread_func();
@@ -69,6 +244,55 @@ private:
     // Worker threads for processing messages
     void worker_thread_func(int worker_id);
 
+    // Worker loop for the stealing dispatch mode
+    void stealing_worker_loop(int worker_id);
+
+    // Fork the supervisor, which forks the worker processes and restarts those that die
+    int start_worker_processes();
+    void supervise_workers();
+    pid_t spawn_worker(int worker_id);
+    // Release the requests a dead worker process still held
+    void recover_worker(int worker_id);
+    bool owns_claim(int worker_id);
+
+    // What to do with a dequeued request: process it, shed it under overload or skip it past its deadline
+    RequestAction request_action(const QueueBlock& block, QueueDelayController& codel);
+
+    // Run the handler on one queued request, inline or out of line
+    void process_block(const QueueSpan& span, const QueueBlock& block, ResponseBatch& responses, QueueDelayController& codel);
+    void process_block(const QueueSpan& span, const QueueBlock& block, ResponseBatch& responses, RequestAction action);
+
+    // Run the batch entry point of handler `module` on a run of its requests from a popped batch
+    void process_batch(const QueueSpan* spans, const QueueBlock* blocks, size_t count, ResponseBatch& responses,
+                       QueueDelayController& codel, HandlerBatch& batch, size_t module);
+
+    // Run the handler on one request, or skip it as `action` says, and queue its response
+    void process_message(const char* data, size_t length, const QueueBlock& block, ResponseBatch& responses,
+                         Payload* request_payload, RequestAction action);
+
+    // Keep the running handler version loaded until a deferred request is answered
+    void hold_deferred(const request_handle_t& handle);
+    void release_deferred(const request_handle_t& handle);
+
+    // Queue the response of a processed request, or close the connection if the handler failed
+    void queue_response(const QueueBlock& block, int result, char* send_data, int send_data_len,
+                        ResponseBatch& responses, Payload* request_payload);
+    // Queue the response to a deferred request, see post_response()
+    bool queue_reply(const request_handle_t& handle, const char* data, size_t length, BlockType type);
+
+    // Send a response block from the send queue to its client once the earlier responses are sent.
+    // `payload` holds an out-of-line response, nullptr for one inside the queue.
+    void deliver_in_order(const char* data, size_t length, const QueueBlock& block, Payload* payload);
+    // Return true if a complete response is held for `sequence`
+    bool holds_response(const ClientInfo& client, uint64_t sequence) const;
+    // Send one response, returns false if the connection was closed
+    bool deliver_response(ClientInfo& client, const char* data, size_t length, BlockType type);
+
+    // Receive queue a connection's requests are pushed to
+    RingQueue& select_recv_queue(const ClientInfo& client);
+    // Receive queue a worker pops from
+    RingQueue& worker_queue(int worker_id);
+
     // Get protocol handler based on connection type (TCP/UDP)
     ProtocolHandler* get_protocol_handler(int flags);
 
@@ -0,0 +1,87 @@
+#include "task_queue.h"
+#include <algorithm>
+
+TaskQueue::TaskQueue() : next_order_(0), rearm_(false), pending_(0), timer_count_(0) {
+}
+
+void TaskQueue::post(TaskFunc fn, void* arg, int delay_ms) {
+    Task task;
+    task.due = std::chrono::steady_clock::now() + std::chrono::milliseconds(delay_ms > 0 ? delay_ms : 0);
+    task.fn = fn;
+    task.arg = arg;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    task.order = next_order_++;
+    if (delay_ms <= 0) {
+        ready_.push_back(task);
+        pending_.fetch_add(1, std::memory_order_seq_cst);
+        return;
+    }
+
+    // Workers parked for the previous earliest timer must recompute their wait
+    bool earliest = timers_.empty() || task.due < timers_.top().due;
+    timers_.push(task);
+    timer_count_.fetch_add(1, std::memory_order_relaxed);
+    if (earliest && !rearm_) {
+        rearm_ = true;
+        pending_.fetch_add(1, std::memory_order_seq_cst);
+    }
+}
+
+size_t TaskQueue::run_ready(size_t max_tasks) {
+    if (pending_.load(std::memory_order_acquire) == 0 && timer_count_.load(std::memory_order_relaxed) == 0) {
+        return 0;
+    }
+
+    size_t run = 0;
+    while (run < max_tasks) {
+        Task task;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto now = std::chrono::steady_clock::now();
+            while (!timers_.empty() && timers_.top().due <= now) {
+                ready_.push_back(timers_.top());
+                timers_.pop();
+                timer_count_.fetch_sub(1, std::memory_order_relaxed);
+                pending_.fetch_add(1, std::memory_order_relaxed);
+            }
+            if (ready_.empty()) {
+                break;
+            }
+            task = ready_.front();
+            ready_.pop_front();
+            pending_.fetch_sub(1, std::memory_order_relaxed);
+        }
+
+        // A task may post more tasks, so it runs without the lock
+        task.fn(task.arg);
+        ++run;
+    }
+    return run;
+}
+
+std::chrono::milliseconds TaskQueue::wait_time(std::chrono::milliseconds max_wait) {
+    if (pending_.load(std::memory_order_acquire) == 0 && timer_count_.load(std::memory_order_relaxed) == 0) {
+        return max_wait;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (rearm_) {
+        rearm_ = false;
+        pending_.fetch_sub(1, std::memory_order_relaxed);
+    }
+    if (!ready_.empty()) {
+        return std::chrono::milliseconds(0);
+    }
+    if (timers_.empty()) {
+        return max_wait;
+    }
+
+    // Round up so the worker wakes after the timer is due, not just before
+    auto until_due = timers_.top().due - std::chrono::steady_clock::now();
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(until_due + std::chrono::microseconds(999));
+    if (wait.count() < 0) {
+        return std::chrono::milliseconds(0);
+    }
+    return std::min(wait, max_wait);
+}
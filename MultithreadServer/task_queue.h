@@ -0,0 +1,56 @@
+#ifndef TASK_QUEUE_H
+#define TASK_QUEUE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <queue>
+#include <vector>
+
+// Continuations handlers post to run on the worker threads of this process,
+// right away or after a delay. Coroutine handlers are resumed through it, so a
+// suspended request holds no thread while it waits.
+// Workers run the ready tasks between queue batches. The pending() counter is
+// non-zero while a task is ready or a new earliest timer was added, a receive
+// queue does not let its consumers park then (see RingQueue::set_pending_work).
+class TaskQueue {
+public:
+    typedef void (*TaskFunc)(void* arg);
+
+    TaskQueue();
+
+    // Queue fn(arg) to run in `delay_ms` milliseconds, 0 to run it as soon as a worker is free
+    void post(TaskFunc fn, void* arg, int delay_ms);
+
+    // Run up to `max_tasks` tasks that are due, returns the number run
+    size_t run_ready(size_t max_tasks);
+
+    // Time a worker may wait for requests before a timer is due, at most `max_wait`
+    std::chrono::milliseconds wait_time(std::chrono::milliseconds max_wait);
+
+    const std::atomic<size_t>& pending() const { return pending_; }
+
+private:
+    struct Task {
+        std::chrono::steady_clock::time_point due;
+        uint64_t order;  // Keeps timers due at the same time in posting order
+        TaskFunc fn;
+        void* arg;
+
+        bool operator>(const Task& other) const {
+            return due != other.due ? due > other.due : order > other.order;
+        }
+    };
+
+    std::mutex mutex_;
+    std::deque<Task> ready_;
+    std::priority_queue<Task, std::vector<Task>, std::greater<Task>> timers_;
+    uint64_t next_order_;
+    bool rearm_;                       // A timer earlier than the others was added since the last wait_time()
+    std::atomic<size_t> pending_;      // Ready tasks, plus one while rearm_ is set
+    std::atomic<size_t> timer_count_;  // Timers waiting, lets idle workers skip the lock
+};
+
+#endif // TASK_QUEUE_H
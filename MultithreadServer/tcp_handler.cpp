@@ -1,5 +1,6 @@
 #include "tcp_handler.h"
 
+#include <cstring>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <netinet/in.h>
@@ -7,7 +8,7 @@
 #include "default_config.h"
 
 // Handle new TCP client connection
-void TcpHandler::accept_client(int server_fd, ClientManager& client_manager, EventDispatcher* dispatcher, dll_func_t* dll_functions, size_t recv_buffer_size, size_t send_buffer_size) {
+ClientInfo* TcpHandler::accept_client(int server_fd, ClientManager& client_manager, EventDispatcher* dispatcher, dll_func_t* dll_functions) {
     sockaddr_in client_addr{};
     socklen_t client_len = sizeof(client_addr);
     int client_fd = accept(server_fd, (sockaddr*)&client_addr, &client_len);
@@ -21,83 +22,64 @@ void TcpHandler::accept_client(int server_fd, ClientManager& client_manager, Eve
         socket_info.local_port = ntohs(client_addr.sin_port);
 
         // Add client to ClientManager
-        ClientInfo* ci = client_manager.add_client(client_fd, socket_info, CN_VALID_MASK | CN_LISTEN_MASK, recv_buffer_size, send_buffer_size);
-
-        int send_len = (int) ci->send_len;
-        if (dll_functions->handle_client_open && dll_functions->handle_client_open(&ci->send_buffer, &(send_len), &ci->socket_info) < 0) {
-            LOG_TRACE("handle_client_open error, remove client.");
-            client_manager.remove_client(client_fd, dispatcher);
-            close(client_fd);
-            return;
+        ClientInfo* ci = client_manager.add_client(client_fd, socket_info, CN_VALID_MASK | CN_LISTEN_MASK);
+
+        if (dll_functions->handle_client_open) {
+            // Lend a send buffer for the greeting, it goes back to the pool if unused
+            char* send_buffer = ci->acquire_send_buffer();
+            int send_len = 0;
+            if (!send_buffer) {
+                LOG_ERR("No send buffer for the greeting of client fd: %d, remove client.", client_fd);
+                client_manager.remove_client(client_fd, dispatcher);
+                close(client_fd);
+                return nullptr;
+            }
+            if (dll_functions->handle_client_open(&send_buffer, &send_len, &ci->socket_info) < 0) {
+                LOG_TRACE("handle_client_open error, remove client.");
+                client_manager.remove_client(client_fd, dispatcher);
+                close(client_fd);
+                return nullptr;
+            }
+            if (send_len > 0 && (size_t)send_len <= ci->send_buffer_size) {
+                if (send_buffer != ci->send_buffer) {
+                    std::memcpy(ci->send_buffer, send_buffer, send_len);
+                }
+                ci->send_len = send_len;
+            }
+            ci->release_send_buffer();
         }
-        
+
         // Add client fd to the event dispatcher
         dispatcher->add_fd(client_fd);
 
         LOG_INFO("Accepted new TCP client: %d", client_fd);
+        return ci;
     } else {
         LOG_ERR("Failed to accept new TCP client on server_fd: %d", server_fd);
+        return nullptr;
     }
 }
 
 // Handle receiving TCP data
-ssize_t TcpHandler::receive_data(ClientInfo& client, dll_func_t* dll_functions, RingQueue& recv_queue) {
-    char buffer[DEFAULT_MAX_PACKET_SIZE];
-    
-    ssize_t bytes_received = recv(client.socket_info.sock_fd, buffer, DEFAULT_MAX_PACKET_SIZE, 0);
+ssize_t TcpHandler::receive_data(ClientInfo& client, dll_func_t* dll_functions, handler_thread_t* thread, RingQueue& recv_queue) {
+    char buffer[DEFAULT_READ_SIZE];
+    QueueReservation reservation;
+    char* recv_target = reserve_receive(client, recv_queue, reservation, buffer);
+    ssize_t bytes_received = recv(client.socket_info.sock_fd, recv_target, DEFAULT_READ_SIZE, 0);
 
     if (bytes_received > 0) {
         LOG_TRACE("recv return len %d.", bytes_received);
-        if (client.recv_len + bytes_received > client.recv_buffer_size) {
-            LOG_ERR("Receive buffer overflow for client fd: %d", client.socket_info.sock_fd);
-            return -1;
-        }
-
-        std::memcpy(client.recv_buffer + client.recv_len, buffer, bytes_received);
-        client.recv_len += bytes_received;
-
-        // Process the accumulated data
-        int result;
-        while ((result = dll_functions->handle_input_from_client(client.recv_buffer, (int)client.recv_len, &client.socket_info)) > 0) {
-            // Handle complete packet
-            LOG_TRACE("Received complete packet size %d from TCP client fd: %d", result, client.socket_info.sock_fd);
-
-            // Push the complete packet to the queue
-            QueueBlock recv_block;
-            recv_block.accept_fd = client.socket_info.sock_fd;
-            recv_block.socket_info = client.socket_info;
-            recv_block.type = BlockType::Data;
-            recv_block.total_length = result + sizeof(QueueBlock);
-
-            recv_queue.push(client.recv_buffer, result, recv_block);
-
-            // Shift any remaining data in recv_buffer
-            size_t remaining_length = client.recv_len - result;
-            if (remaining_length > 0) {
-                std::memmove(client.recv_buffer, client.recv_buffer + result, remaining_length);
-            }
-            client.recv_len = remaining_length;
-            if (client.recv_len == 0) {
-                result = 0;
-                break;
-            }
-        }
-
-        // If `handle_input_from_client` returns 0, it means we're still waiting for more data.
-        if (result == 0) {
-            return 0;
-        } else {
-            // `handle_input_from_client` returned a negative value, indicating an error.
-            LOG_WARN("Closing TCP connection on fd: %d", client.socket_info.sock_fd);
-            return -1;
-        }
-    } else if (bytes_received == 0) {
+        return queue_received(client, dll_functions, thread, recv_queue, reservation, buffer, bytes_received);
+    }
+    if (reservation.data) {
+        recv_queue.cancel(reservation);
+    }
+    if (bytes_received == 0) {
         LOG_INFO("TCP client closed connection: %d", client.socket_info.sock_fd);
-        return -1;
     } else {
         LOG_ERR("Error receiving data from TCP client fd: %d", client.socket_info.sock_fd);
-        return -1;
     }
+    return -1;
 }
 
 // Handle sending TCP data
@@ -106,8 +88,9 @@ ssize_t TcpHandler::send_data(ClientInfo& client, const char* buffer, size_t len
 
     // Step 1: If there is leftover data in send_buffer, append the new data to it
     if (client.send_len > 0) {
-        if (client.send_len + length <= client.send_buffer_size) {
+        if (client.reserve_send_buffer(client.send_len + length)) {
             std::memcpy(client.send_buffer + client.send_len, buffer, length);
+            count_response_copy(length);
             client.send_len += length;
         } else {
             LOG_ERR("Send buffer overflow for client fd: %d", client.socket_info.sock_fd);
@@ -129,15 +112,19 @@ ssize_t TcpHandler::send_data(ClientInfo& client, const char* buffer, size_t len
             if ((size_t)bytes_sent < client.send_len) {
                 size_t remaining_length = client.send_len - bytes_sent;
                 std::memmove(client.send_buffer, client.send_buffer + bytes_sent, remaining_length);
+                count_response_copy(remaining_length);
                 client.send_len = remaining_length;
             } else {
                 client.send_len = 0;
+                client.release_send_buffer();
             }
         } else if ((size_t)bytes_sent < length) {
-            // Not all data was sent, store the unsent part in send_buffer
+            // Not all data was sent, store the unsent part in a borrowed send_buffer
             size_t remaining_length = length - bytes_sent;
-            if (remaining_length <= client.send_buffer_size) {
-                std::memcpy(client.send_buffer, buffer + bytes_sent, remaining_length);
+            char* pending = client.reserve_send_buffer(remaining_length);
+            if (pending) {
+                std::memcpy(pending, buffer + bytes_sent, remaining_length);
+                count_response_copy(remaining_length);
                 client.send_len = remaining_length;
             } else {
                 LOG_ERR("Send buffer overflow for client fd: %d", client.socket_info.sock_fd);
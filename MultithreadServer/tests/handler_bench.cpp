@@ -0,0 +1,111 @@
+// Benchmark of the sample handler loaded with dlopen() by ../mulserver against
+// the same handler linked into ../mulserver_static (`make static`), where the
+// framing and message calls are direct and optimised together with the server.
+// Measures the p50/p99 round trip of one request at a time on one connection,
+// then the throughput of several connections with one request in flight each.
+// The server does not disable Nagle, pipelined responses would wait for
+// delayed acknowledgements instead of the handler.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 64;
+constexpr int CONNECTIONS = 8;
+
+struct Result {
+    uint32_t p50;
+    uint32_t p99;
+    double requests_per_second;
+};
+
+// Send one frame and wait for its echo. The sample handler frames by a leading 32-bit total length.
+static bool round_trip(int fd) {
+    char frame[FRAME_SIZE];
+    std::memset(frame, 'x', sizeof(frame));
+    uint32_t length = FRAME_SIZE;
+    std::memcpy(frame, &length, sizeof(length));
+    char response[FRAME_SIZE];
+    return send_all(fd, frame, sizeof(frame)) && recv_all(fd, response, sizeof(response)) &&
+           std::memcmp(frame, response, sizeof(frame)) == 0;
+}
+
+static bool run(const std::string& binary, const std::string& handler, size_t round_trips, size_t requests, Result& result) {
+    ServerProcess server("worker_num = 2\n", handler, binary);
+    int fds[CONNECTIONS];
+    for (int& fd : fds) {
+        fd = server.connect_client();
+        if (fd < 0) {
+            return false;
+        }
+    }
+
+    // One request at a time
+    std::vector<uint32_t> latencies;
+    latencies.reserve(round_trips);
+    for (size_t i = 0; i < round_trips; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        if (!round_trip(fds[0])) {
+            return false;
+        }
+        latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    result.p50 = latencies[latencies.size() / 2];
+    result.p99 = latencies[latencies.size() * 99 / 100];
+
+    // Every connection has a client thread keeping one request in flight
+    std::atomic<size_t> failed(0);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (int fd : fds) {
+        clients.emplace_back([&, fd] {
+            for (size_t i = 0; i < requests / CONNECTIONS; ++i) {
+                if (!round_trip(fd)) {
+                    failed.fetch_add(1);
+                    return;
+                }
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.requests_per_second = requests / CONNECTIONS * CONNECTIONS / seconds;
+    for (int fd : fds) {
+        close(fd);
+    }
+    return failed.load() == 0 && server.running();
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    size_t round_trips = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+    size_t requests = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 200000;
+    if (access("../mulserver_static", X_OK) != 0) {
+        std::printf("handler_bench: ../mulserver_static not found, build it with `make static`\n");
+        return 1;
+    }
+    std::printf("handler_bench: %zu round trips, %zu requests of %zu bytes on %d connections, %u hardware threads\n",
+                round_trips, requests, FRAME_SIZE, CONNECTIONS, std::thread::hardware_concurrency());
+    std::printf("%-22s %10s %10s %14s\n", "handler", "p50 us", "p99 us", "requests/s");
+    const struct {
+        const char* name;
+        const char* binary;
+        const char* handler;
+    } builds[] = {{"dlopen", "../mulserver", "libtest_handler.so"}, {"linked, LTO", "../mulserver_static", ""}};
+    for (const auto& build : builds) {
+        Result result = Result();
+        bool completed = run(build.binary, build.handler, round_trips, requests, result);
+        CHECK(completed);
+        std::printf("%-22s %10u %10u %14.0f\n", build.name, result.p50, result.p99, result.requests_per_second);
+    }
+    return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,58 @@
+// Pipeline one slow request and a run of fast ones on a connection served by
+// two workers popping a shared queue one block at a time. The fast responses
+// are held until the slow one is sent: within max_held_responses they all
+// arrive in order, beyond it the server closes the connection rather than
+// hold them without bound.
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 12;
+constexpr int FAST_FRAMES = 10;
+
+// Send the slow frame and the fast ones, return how many responses arrived in order
+static int pipeline(int fd) {
+    std::vector<char> frames((FAST_FRAMES + 1) * FRAME_SIZE, 0);
+    for (int i = 0; i <= FAST_FRAMES; ++i) {
+        char* frame = frames.data() + i * FRAME_SIZE;
+        uint32_t length = FRAME_SIZE;
+        std::memcpy(frame, &length, sizeof(length));
+        frame[4] = i == 0 ? 'W' : 'U';
+        frame[5] = (char)i;
+    }
+    if (!send_all(fd, frames.data(), frames.size())) {
+        return 0;
+    }
+    int received = 0;
+    char response[FRAME_SIZE];
+    while (received <= FAST_FRAMES && recv_all(fd, response, sizeof(response)) && response[5] == (char)received) {
+        ++received;
+    }
+    return received;
+}
+
+int main() {
+    init_test_log();
+    const struct {
+        const char* config;
+        int expected;
+    } cases[] = {{"", FAST_FRAMES + 1}, {"max_held_responses = 4\n", 0}};
+    for (const auto& test_case : cases) {
+        ServerProcess server(std::string("worker_num = 2\ndispatch_mode = shared\nqueue_batch = 1\n") + test_case.config,
+                             "libtest_lane_handler.so");
+        int fd = server.connect_client();
+        CHECK(fd >= 0);
+        if (fd < 0) {
+            continue;
+        }
+        int received = pipeline(fd);
+        CHECK(received == test_case.expected);
+        CHECK(server.running());
+        close(fd);
+        std::printf("  %-24s %d of %d responses\n", test_case.config[0] ? "max_held_responses = 4:" : "default limit:",
+                    received, FAST_FRAMES + 1);
+    }
+    return test_result("held_responses_test");
+}
@@ -0,0 +1,132 @@
+// Interactive latency under a bulk flood, with priority lanes and with one
+// shared lane. Bulk connections keep a window of slow requests in flight that
+// the handler sends to lane 2, while one interactive connection sends urgent
+// requests for lane 0 one at a time. With queue_lanes = 1 every request shares
+// lane 0 and the urgent ones wait behind the backlog. Workers pop one block at
+// a time: a worker claiming a batch takes the backlog out of the queue with it,
+// and an urgent request waits for the batch whatever its lane.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <netinet/tcp.h>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 12;
+constexpr int BULK_CONNECTIONS = 4;
+constexpr int BULK_WINDOW = 16;
+
+struct Result {
+    uint32_t p50;
+    uint32_t p99;
+    double bulk_per_second;
+};
+
+static void make_frame(char* frame, char type) {
+    std::memset(frame, 0, FRAME_SIZE);
+    uint32_t length = FRAME_SIZE;
+    std::memcpy(frame, &length, sizeof(length));
+    frame[4] = type;
+}
+
+// Keep `BULK_WINDOW` slow requests in flight on `fd` until `stop` is set
+static void flood(int fd, const std::atomic<bool>& stop, std::atomic<size_t>& done) {
+    std::atomic<int> inflight(0);
+    std::thread reader([&] {
+        // Acknowledge at once, the server does not disable Nagle and would hold responses back
+        // for a delayed acknowledgement, letting the backlog drain
+        int quick_ack = 1;
+        char response[FRAME_SIZE];
+        while (setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &quick_ack, sizeof(quick_ack)) == 0 &&
+               recv_all(fd, response, sizeof(response))) {
+            inflight.fetch_sub(1);
+            done.fetch_add(1);
+        }
+    });
+    char frame[FRAME_SIZE];
+    make_frame(frame, 'S');
+    while (!stop.load()) {
+        if (inflight.load() >= BULK_WINDOW) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            continue;
+        }
+        inflight.fetch_add(1);
+        if (!send_all(fd, frame, sizeof(frame))) {
+            break;
+        }
+    }
+    shutdown(fd, SHUT_RDWR);
+    reader.join();
+}
+
+static bool run(int lanes, int requests, Result& result) {
+    ServerProcess server("worker_num = 2\nqueue_batch = 1\nqueue_lanes = " + std::to_string(lanes) + "\n", "libtest_lane_handler.so");
+    int interactive = server.connect_client();
+    int bulk[BULK_CONNECTIONS];
+    for (int& fd : bulk) {
+        fd = server.connect_client();
+    }
+    if (interactive < 0 || std::any_of(bulk, bulk + BULK_CONNECTIONS, [](int fd) { return fd < 0; })) {
+        return false;
+    }
+
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> bulk_done(0);
+    std::vector<std::thread> floods;
+    auto flood_start = std::chrono::steady_clock::now();
+    for (int fd : bulk) {
+        floods.emplace_back(flood, fd, std::cref(stop), std::ref(bulk_done));
+    }
+    // Let the backlog build up
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+
+    char frame[FRAME_SIZE];
+    char response[FRAME_SIZE];
+    make_frame(frame, 'U');
+    std::vector<uint32_t> latencies;
+    bool answered = true;
+    for (int i = 0; i < requests && answered; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        answered = send_all(interactive, frame, sizeof(frame)) && recv_all(interactive, response, sizeof(response));
+        latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    stop.store(true);
+    for (auto& thread : floods) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - flood_start).count();
+    for (int fd : bulk) {
+        close(fd);
+    }
+    close(interactive);
+
+    std::sort(latencies.begin(), latencies.end());
+    result.p50 = latencies[latencies.size() / 2];
+    result.p99 = latencies[latencies.size() * 99 / 100];
+    result.bulk_per_second = bulk_done.load() / seconds;
+    return answered && server.running();
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    int requests = argc > 1 ? atoi(argv[1]) : 200;
+    std::printf("lane_bench: %d urgent requests against %d bulk connections with %d slow requests in flight each\n",
+                requests, BULK_CONNECTIONS, BULK_WINDOW);
+    std::printf("%-22s %12s %12s %12s\n", "queue", "urgent p50", "urgent p99", "bulk/s");
+    const struct {
+        const char* name;
+        int lanes;
+    } modes[] = {{"one shared lane", 1}, {"three lanes", 3}};
+    for (const auto& mode : modes) {
+        Result result = Result();
+        bool completed = run(mode.lanes, requests, result);
+        CHECK(completed);
+        std::printf("%-22s %9u us %9u us %12.0f\n", mode.name, result.p50, result.p99, result.bulk_per_second);
+    }
+    return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,51 @@
+// Handler for lane_order_test, held_responses_test and overload_test: frames
+// starting with 'U' after the length are urgent and go to lane 0, the others to
+// lane 2 and take a millisecond, 'W' ones 200 milliseconds. Each response
+// carries the order in which the worker processed its request, or SHED_ORDER
+// when the server shed it as overload.
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <unistd.h>
+
+struct SocketInfo;
+
+static std::atomic<uint32_t> processed(0);
+static const uint32_t SHED_ORDER = UINT32_MAX;
+
+extern "C" {
+
+int handle_input_from_client(const char* buffer, int length, const SocketInfo*) {
+    uint32_t frame_length;
+    if (length < (int)sizeof(frame_length)) {
+        return 0;
+    }
+    std::memcpy(&frame_length, buffer, sizeof(frame_length));
+    return length >= (int)frame_length ? (int)frame_length : 0;
+}
+
+int handle_input_priority(const char* frame, int, const SocketInfo*) {
+    return frame[4] == 'U' ? 0 : 2;
+}
+
+int handle_message_from_client(const char* data, int length, char** send_data, int* send_data_len, const SocketInfo*) {
+    if (data[4] == 'W') {
+        usleep(200000);
+    } else if (data[4] != 'U') {
+        usleep(1000);
+    }
+    uint32_t order = processed.fetch_add(1);
+    std::memcpy(*send_data, data, length);
+    std::memcpy(*send_data + length - sizeof(order), &order, sizeof(order));
+    *send_data_len = length;
+    return 0;
+}
+
+int handle_overload(const char* data, int length, char** send_data, int* send_data_len, const SocketInfo*) {
+    std::memcpy(*send_data, data, length);
+    std::memcpy(*send_data + length - sizeof(SHED_ORDER), &SHED_ORDER, sizeof(SHED_ORDER));
+    *send_data_len = length;
+    return 0;
+}
+
+}
@@ -0,0 +1,53 @@
+// Pipeline slow requests of a low-priority lane and urgent ones of lane 0 on
+// one ordered connection. The workers must still process them in arrival
+// order, whatever lane the handler picks for each frame. Shared dispatch is
+// left out, its workers pop one queue together and only the replies are ordered.
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 12;
+constexpr int FRAMES = 100;
+
+int main() {
+    init_test_log();
+    for (const char* dispatch : {"affinity", "stealing"}) {
+        ServerProcess server(std::string("queue_lanes = 3\nworker_num = 2\ndispatch_mode = ") + dispatch + "\n",
+                             "libtest_lane_handler.so");
+        int fd = server.connect_client();
+        CHECK(fd >= 0);
+        if (fd < 0) {
+            continue;
+        }
+
+        // Slow and urgent requests alternate, all sent together
+        std::vector<char> frames(FRAMES * FRAME_SIZE, 0);
+        for (int i = 0; i < FRAMES; ++i) {
+            char* frame = frames.data() + i * FRAME_SIZE;
+            uint32_t length = FRAME_SIZE;
+            std::memcpy(frame, &length, sizeof(length));
+            frame[4] = (i % 2) ? 'U' : 'S';
+        }
+        std::vector<char> responses(frames.size());
+        CHECK(send_all(fd, frames.data(), frames.size()) && recv_all(fd, responses.data(), responses.size()));
+
+        int reordered = 0;
+        uint32_t last = 0;
+        for (int i = 0; i < FRAMES; ++i) {
+            const char* response = responses.data() + i * FRAME_SIZE;
+            CHECK(response[4] == frames[i * FRAME_SIZE + 4]);
+            uint32_t order;
+            std::memcpy(&order, response + FRAME_SIZE - sizeof(order), sizeof(order));
+            if (i > 0 && order <= last) {
+                ++reordered;
+            }
+            last = order;
+        }
+        CHECK(reordered == 0);
+        close(fd);
+        std::printf("  %-9s dispatch: %d of %d requests processed ahead of an earlier one\n", dispatch, reordered, FRAMES);
+    }
+    return test_result("lane_order_test");
+}
@@ -0,0 +1,60 @@
+// Echo frames larger than the response space a worker lends the handler
+// (DEFAULT_INLINE_PAYLOAD bytes) through the sample handler, between small
+// ones, and check every response arrives whole and in order.
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+#include "default_config.h"
+
+LogManager* g_log_manager;
+
+// The sample handler frames by a leading 32-bit total length
+static std::vector<char> make_frame(size_t length, char fill) {
+    std::vector<char> frame(length, fill);
+    uint32_t total = (uint32_t)length;
+    std::memcpy(frame.data(), &total, sizeof(total));
+    for (size_t i = sizeof(total); i < length; ++i) {
+        frame[i] = (char)(fill + i % 31);
+    }
+    return frame;
+}
+
+static bool echo(int fd, const std::vector<char>& frame) {
+    std::vector<char> response(frame.size());
+    return send_all(fd, frame.data(), frame.size()) && recv_all(fd, response.data(), response.size()) &&
+           response == frame;
+}
+
+int main() {
+    init_test_log();
+    for (const char* mode : {"thread", "process"}) {
+        ServerProcess server(std::string("max_packet_size = 2000000\nworker_num = 2\nworker_mode = ") + mode + "\n",
+                             "libtest_handler.so");
+        int fd = server.connect_client();
+        CHECK(fd >= 0);
+        if (fd < 0) {
+            continue;
+        }
+        CHECK(echo(fd, make_frame(64, 'a')));
+        for (size_t length : {(size_t)DEFAULT_INLINE_PAYLOAD + 1, (size_t)100 * 1024, (size_t)1000 * 1000}) {
+            CHECK(echo(fd, make_frame(length, 'b')));
+            CHECK(echo(fd, make_frame(64, 'c')));
+        }
+
+        // Pipelined, a large response between small ones keeps its place
+        std::vector<char> frames;
+        std::vector<char> large = make_frame(100 * 1024, 'd');
+        std::vector<char> small = make_frame(100, 'e');
+        for (int i = 0; i < 4; ++i) {
+            frames.insert(frames.end(), small.begin(), small.end());
+            frames.insert(frames.end(), large.begin(), large.end());
+        }
+        std::vector<char> responses(frames.size());
+        CHECK(send_all(fd, frames.data(), frames.size()) && recv_all(fd, responses.data(), responses.size()));
+        CHECK(responses == frames);
+        CHECK(server.running());
+        close(fd);
+        std::printf("  %-8s worker mode echoed frames up to 1000000 bytes\n", mode);
+    }
+    return test_result("large_frame_test");
+}
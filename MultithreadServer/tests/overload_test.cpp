@@ -0,0 +1,135 @@
+// Offer one worker twice the requests it can serve for two seconds, with the
+// queue delay controller on and off. Goodput counts the requests the handler
+// processed and answered within RESPONSE_DEADLINE_MS. With codel_target set the
+// worker sheds the excess and keeps serving the rest promptly, so goodput stays
+// near capacity; without it the backlog grows and almost every answer is late.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <netinet/tcp.h>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 12;
+constexpr int CONNECTIONS = 4;
+constexpr int CAPACITY = 1000;                  // Requests per second of one worker, the handler takes 1 ms each
+constexpr int OFFERED = 2 * CAPACITY;
+constexpr int DURATION_MS = 2000;
+constexpr int RESPONSE_DEADLINE_MS = 100;
+constexpr uint32_t SHED_ORDER = UINT32_MAX;     // Order the test handler answers shed requests with
+
+struct Result {
+    size_t sent;
+    size_t answered;
+    size_t shed;
+    size_t good;
+};
+
+// Send requests on `fd` at `rate` per second for DURATION_MS, and read their
+// responses until all arrived or the connection times out
+static void drive(int fd, int rate, Result& result) {
+    typedef std::chrono::steady_clock clock;
+    std::deque<clock::time_point> sent_at;
+    std::mutex mutex;
+    std::atomic<bool> sending(true);
+    std::thread reader([&] {
+        // Acknowledge at once, the server does not disable Nagle
+        int quick_ack = 1;
+        char response[FRAME_SIZE];
+        while (setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &quick_ack, sizeof(quick_ack)) == 0 &&
+               recv_all(fd, response, sizeof(response))) {
+            clock::time_point start;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                start = sent_at.front();
+                sent_at.pop_front();
+            }
+            ++result.answered;
+            uint32_t order;
+            std::memcpy(&order, response + FRAME_SIZE - sizeof(order), sizeof(order));
+            if (order == SHED_ORDER) {
+                ++result.shed;
+            } else if (clock::now() - start <= std::chrono::milliseconds(RESPONSE_DEADLINE_MS)) {
+                ++result.good;
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!sending.load() && sent_at.empty()) {
+                break;
+            }
+        }
+    });
+
+    char frame[FRAME_SIZE] = {};
+    uint32_t length = FRAME_SIZE;
+    std::memcpy(frame, &length, sizeof(length));
+    frame[4] = 'S';
+    auto start = clock::now();
+    auto interval = std::chrono::microseconds(1000000 / rate);
+    for (auto next = start; next - start < std::chrono::milliseconds(DURATION_MS); next += interval) {
+        std::this_thread::sleep_until(next);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            sent_at.push_back(clock::now());
+        }
+        if (!send_all(fd, frame, sizeof(frame))) {
+            break;
+        }
+        ++result.sent;
+    }
+    sending.store(false);
+    reader.join();
+}
+
+static bool run(const std::string& codel, Result& total) {
+    ServerProcess server("worker_num = 1\nqueue_batch = 1\n" + codel, "libtest_lane_handler.so");
+    int fds[CONNECTIONS];
+    for (int& fd : fds) {
+        fd = server.connect_client();
+        if (fd < 0) {
+            return false;
+        }
+    }
+    Result results[CONNECTIONS] = {};
+    std::vector<std::thread> clients;
+    for (int i = 0; i < CONNECTIONS; ++i) {
+        clients.emplace_back(drive, fds[i], OFFERED / CONNECTIONS, std::ref(results[i]));
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    for (int i = 0; i < CONNECTIONS; ++i) {
+        close(fds[i]);
+        total.sent += results[i].sent;
+        total.answered += results[i].answered;
+        total.shed += results[i].shed;
+        total.good += results[i].good;
+    }
+    return server.running();
+}
+
+int main() {
+    init_test_log();
+    Result controlled = Result();
+    Result uncontrolled = Result();
+    CHECK(run("codel_target = 5\ncodel_interval = 50\n", controlled));
+    CHECK(run("", uncontrolled));
+    double seconds = DURATION_MS / 1000.0;
+    for (const Result* result : {&controlled, &uncontrolled}) {
+        std::printf("  codel %-4s %zu sent, %zu answered, %zu shed, goodput %.0f/s of capacity %d/s\n",
+                    result == &controlled ? "on:" : "off:", result->sent, result->answered, result->shed,
+                    result->good / seconds, CAPACITY);
+    }
+    // Every request is answered, shed or not
+    CHECK(controlled.answered == controlled.sent);
+    CHECK(controlled.shed > 0);
+    CHECK(controlled.good / seconds >= 0.6 * CAPACITY);
+    CHECK(uncontrolled.shed == 0);
+    CHECK(uncontrolled.good < controlled.good / 2);
+    return test_result("overload_test");
+}
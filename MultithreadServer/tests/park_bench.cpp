@@ -0,0 +1,138 @@
+// Benchmark of how idle consumers wait on a RingQueue: parking on the futex at
+// once, spinning and yielding before parking (the server's default policy),
+// and busy polling without ever parking. For each policy it reports the CPU
+// time 4 consumers burn on an empty queue, the push-to-pop latency of sparse
+// messages that each find the consumers idle, and the throughput of a
+// producer pushing as fast as it can.
+#include <algorithm>
+#include <atomic>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "ring_queue.h"
+#include "default_config.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t MESSAGE_SIZE = 64;
+constexpr size_t QUEUE_SIZE = 1 << 20;
+constexpr int CONSUMERS = 4;
+
+enum class WaitMode { Park, Poll };
+
+struct Policy {
+    const char* name;
+    WaitMode mode;
+    int spin_count;
+    int yield_count;
+};
+
+struct Result {
+    double idle_cpu_percent;
+    uint32_t p50;
+    uint32_t p99;
+    double messages_per_second;
+};
+
+// CPU time used by the process so far, in seconds
+static double cpu_seconds() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static Result run(const Policy& policy, size_t sparse_messages, size_t messages) {
+    RingQueue queue(QUEUE_SIZE);
+    queue.set_wait_policy(policy.spin_count, policy.yield_count);
+    std::atomic<bool> stop(false);
+    std::atomic<size_t> popped(0);
+    std::vector<std::vector<uint32_t>> latencies(CONSUMERS);
+
+    std::vector<std::thread> consumers;
+    for (int i = 0; i < CONSUMERS; ++i) {
+        consumers.emplace_back([&, i] {
+            QueueSpan span;
+            QueueBlock block;
+            while (!stop.load(std::memory_order_relaxed)) {
+                std::chrono::milliseconds timeout(policy.mode == WaitMode::Park ? 100 : 0);
+                if (queue.peek(span, block, timeout)) {
+                    if (block.sequence != 0) {
+                        latencies[i].push_back(queue_clock() - block.timestamp);
+                    }
+                    queue.release(span);
+                    popped.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    Result result = Result();
+    // Idle: nothing is queued for a second
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    double cpu_start = cpu_seconds();
+    auto idle_start = std::chrono::steady_clock::now();
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    double idle_wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - idle_start).count();
+    result.idle_cpu_percent = (cpu_seconds() - cpu_start) / idle_wall * 100;
+
+    // Sparse: every message finds the consumers waiting
+    char data[MESSAGE_SIZE] = {};
+    QueueBlock header = QueueBlock();
+    header.type = BlockType::Data;
+    for (size_t i = 0; i < sparse_messages; ++i) {
+        header.sequence = 1;
+        header.timestamp = queue_clock();
+        queue.push(data, sizeof(data), header);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    // Saturated: one producer pushes as fast as the consumers take
+    header.sequence = 0;
+    size_t target = popped.load() + messages;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < messages; ++i) {
+        while (!queue.push(data, sizeof(data), header)) {
+            std::this_thread::yield();
+        }
+    }
+    while (popped.load() < target) {
+        std::this_thread::yield();
+    }
+    result.messages_per_second = messages / std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    stop.store(true);
+    queue.wake(CONSUMERS);
+    for (auto& consumer : consumers) {
+        consumer.join();
+    }
+    std::vector<uint32_t> all;
+    for (auto& latency : latencies) {
+        all.insert(all.end(), latency.begin(), latency.end());
+    }
+    std::sort(all.begin(), all.end());
+    if (!all.empty()) {
+        result.p50 = all[all.size() / 2];
+        result.p99 = all[all.size() * 99 / 100];
+    }
+    CHECK(all.size() == sparse_messages);
+    return result;
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    size_t sparse_messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 2000;
+    size_t messages = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000;
+    std::printf("park_bench: %d consumers, %zu sparse messages 500 us apart, %zu messages of %zu bytes, %u hardware threads\n",
+                CONSUMERS, sparse_messages, messages, MESSAGE_SIZE, std::thread::hardware_concurrency());
+    std::printf("%-28s %12s %12s %12s %14s\n", "wait", "idle CPU %", "wake p50 us", "wake p99 us", "messages/s");
+    const Policy policies[] = {{"park at once", WaitMode::Park, 0, 0},
+                               {"spin, yield, then park", WaitMode::Park, DEFAULT_QUEUE_SPIN, DEFAULT_QUEUE_YIELD},
+                               {"busy poll", WaitMode::Poll, 0, 0}};
+    for (const Policy& policy : policies) {
+        Result result = run(policy, sparse_messages, messages);
+        std::printf("%-28s %12.1f %12u %12u %14.0f\n", policy.name, result.idle_cpu_percent, result.p50, result.p99,
+                    result.messages_per_second);
+    }
+    return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,86 @@
+// Reload the handler with SIGUSR1 while several connections keep echo requests
+// in flight, with worker threads and worker processes. Every request must be
+// answered with its own echo across the reloads, on the same connections, and
+// the server log must show the new handler generations being loaded and
+// threads moving to them.
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 64;
+constexpr int CONNECTIONS = 4;
+constexpr int RELOADS = 3;
+
+// Echo numbered frames on `fd` one at a time until `stop` is set, counting the
+// answered requests and the ones that failed or came back wrong
+static void load(int fd, const std::atomic<bool>& stop, std::atomic<size_t>& answered, std::atomic<size_t>& failed) {
+    char frame[FRAME_SIZE];
+    char response[FRAME_SIZE];
+    std::memset(frame, 'x', sizeof(frame));
+    uint32_t length = FRAME_SIZE;
+    std::memcpy(frame, &length, sizeof(length));
+    for (uint32_t i = 0; !stop.load(); ++i) {
+        std::memcpy(frame + sizeof(length), &i, sizeof(i));
+        if (!send_all(fd, frame, sizeof(frame)) || !recv_all(fd, response, sizeof(response)) ||
+            std::memcmp(frame, response, sizeof(frame)) != 0) {
+            failed.fetch_add(1);
+            return;
+        }
+        answered.fetch_add(1);
+    }
+}
+
+int main() {
+    init_test_log();
+    for (const char* mode : {"thread", "process"}) {
+        ServerProcess server(std::string("log_level = 6\nworker_num = 2\nworker_mode = ") + mode + "\n",
+                             "libtest_handler.so");
+        int fds[CONNECTIONS];
+        bool connected = true;
+        for (int& fd : fds) {
+            fd = server.connect_client();
+            connected = connected && fd >= 0;
+        }
+        CHECK(connected);
+        if (!connected) {
+            continue;
+        }
+
+        std::atomic<bool> stop(false);
+        std::atomic<size_t> answered(0);
+        std::atomic<size_t> failed(0);
+        std::vector<std::thread> clients;
+        for (int fd : fds) {
+            clients.emplace_back(load, fd, std::cref(stop), std::ref(answered), std::ref(failed));
+        }
+        // The server looks for a reload request once a second
+        for (int i = 0; i < RELOADS; ++i) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(500));
+            kill(server.pid(), SIGUSR1);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1000));
+        }
+        stop.store(true);
+        for (auto& client : clients) {
+            client.join();
+        }
+        for (int fd : fds) {
+            close(fd);
+        }
+
+        int loaded = server.log_count("loaded from");
+        int moved = server.log_count("moved from handler generation");
+        CHECK(failed.load() == 0);
+        CHECK(answered.load() > 0);
+        CHECK(loaded >= RELOADS);
+        CHECK(moved > 0);
+        CHECK(server.running());
+        std::printf("  %-8s worker mode: %zu requests answered, %zu failed, %d handler generations loaded, "
+                    "%d thread switches\n", mode, answered.load(), failed.load(), loaded, moved);
+    }
+    return test_result("reload_test");
+}
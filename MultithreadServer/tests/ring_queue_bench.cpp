@@ -0,0 +1,162 @@
+// Contention benchmark of the RingQueue against the mutex + condition_variable
+// queue it replaced, at 1, 4, 16 and 32 workers. Small messages, the queue
+// overhead dominates. Two shapes: one producer feeding the workers, as the
+// network thread does, and as many producers as consumers.
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "ring_queue.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t MESSAGE_SIZE = 64;
+constexpr size_t QUEUE_SIZE = 1 << 20;
+
+// Bounded FIFO behind one mutex, as the queue was before it became lock-free
+class LockedQueue {
+public:
+    explicit LockedQueue(size_t capacity) : capacity_(capacity) {}
+
+    bool push(const char* data, size_t length) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (messages_.size() >= capacity_) {
+            return false;
+        }
+        messages_.emplace_back(data, data + length);
+        lock.unlock();
+        cond_var_.notify_one();
+        return true;
+    }
+
+    bool wait_and_pop(char* data, size_t& length, std::chrono::milliseconds timeout) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!cond_var_.wait_for(lock, timeout, [this] { return !messages_.empty(); })) {
+            return false;
+        }
+        length = messages_.front().size();
+        std::memcpy(data, messages_.front().data(), length);
+        messages_.pop_front();
+        return true;
+    }
+
+private:
+    size_t capacity_;
+    std::mutex mutex_;
+    std::condition_variable cond_var_;
+    std::deque<std::vector<char>> messages_;
+};
+
+struct Result {
+    double messages_per_second;
+    double nanoseconds_per_message;
+};
+
+template <typename Push, typename Pop>
+static Result run(int producers, int consumers, size_t messages, Push push, Pop pop) {
+    std::atomic<size_t> consumed(0);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < consumers; ++i) {
+        threads.emplace_back([&] {
+            while (consumed.load(std::memory_order_relaxed) < messages) {
+                size_t count = pop();
+                if (count > 0) {
+                    consumed.fetch_add(count, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+    for (int i = 0; i < producers; ++i) {
+        size_t share = messages / producers + (i == 0 ? messages % producers : 0);
+        threads.emplace_back([&, share] { push(share); });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return {messages / seconds, seconds * 1e9 / messages};
+}
+
+static Result bench_ring(int producers, int consumers, size_t messages, bool batched) {
+    RingQueue queue(QUEUE_SIZE);
+    const std::chrono::milliseconds timeout(10);
+    auto push = [&](size_t count) {
+        char data[MESSAGE_SIZE] = {};
+        QueueBlock header = QueueBlock();
+        header.type = BlockType::Data;
+        if (!batched) {
+            for (size_t i = 0; i < count;) {
+                i += queue.push(data, sizeof(data), header) ? 1 : 0;
+            }
+            return;
+        }
+        // The network thread pushes every frame of one read together
+        QueueBlock headers[16];
+        const char* pointers[16];
+        size_t lengths[16];
+        std::fill(headers, headers + 16, header);
+        std::fill(pointers, pointers + 16, data);
+        std::fill(lengths, lengths + 16, sizeof(data));
+        for (size_t i = 0; i < count;) {
+            i += queue.push_batch(headers, pointers, lengths, std::min<size_t>(16, count - i));
+        }
+    };
+    auto pop = [&]() -> size_t {
+        char buffer[16 * MESSAGE_SIZE];
+        if (!batched) {
+            QueueBlock header;
+            size_t length;
+            return queue.wait_and_pop(buffer, sizeof(buffer), length, header, timeout) ? 1 : 0;
+        }
+        QueueBlock headers[16];
+        size_t lengths[16];
+        return queue.pop_batch(buffer, sizeof(buffer), headers, lengths, 16, timeout);
+    };
+    return run(producers, consumers, messages, push, pop);
+}
+
+static Result bench_locked(int producers, int consumers, size_t messages) {
+    LockedQueue queue(QUEUE_SIZE / MESSAGE_SIZE);
+    auto push = [&](size_t count) {
+        char data[MESSAGE_SIZE] = {};
+        for (size_t i = 0; i < count;) {
+            i += queue.push(data, sizeof(data)) ? 1 : 0;
+        }
+    };
+    auto pop = [&]() -> size_t {
+        char buffer[MESSAGE_SIZE];
+        size_t length;
+        return queue.wait_and_pop(buffer, length, std::chrono::milliseconds(10)) ? 1 : 0;
+    };
+    return run(producers, consumers, messages, push, pop);
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    size_t messages = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    std::printf("ring_queue_bench: %zu messages of %zu bytes, %u hardware threads\n",
+                messages, MESSAGE_SIZE, std::thread::hardware_concurrency());
+    std::printf("%-10s %-9s %-24s %14s %10s\n", "producers", "workers", "queue", "messages/s", "ns/msg");
+    for (int workers : {1, 4, 16, 32}) {
+        for (int producers : {1, workers}) {
+            Result locked = bench_locked(producers, workers, messages);
+            Result ring = bench_ring(producers, workers, messages, false);
+            std::printf("%-10d %-9d %-24s %14.0f %10.1f\n", producers, workers, "mutex + condvar", locked.messages_per_second, locked.nanoseconds_per_message);
+            std::printf("%-10d %-9d %-24s %14.0f %10.1f\n", producers, workers, "lock-free push/pop", ring.messages_per_second, ring.nanoseconds_per_message);
+            if (producers == 1) {
+                Result batched = bench_ring(producers, workers, messages, true);
+                std::printf("%-10d %-9d %-24s %14.0f %10.1f\n", producers, workers, "lock-free batch of 16", batched.messages_per_second, batched.nanoseconds_per_message);
+            }
+            if (workers == 1) {
+                break;
+            }
+        }
+    }
+    return 0;
+}
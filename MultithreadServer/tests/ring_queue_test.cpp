@@ -0,0 +1,315 @@
+// Multi-threaded stress test of the lock-free RingQueue. Producers push
+// numbered blocks through push, push_batch and reserve/commit; consumers take
+// them through wait_and_pop, pop_batch, peek/release and peek_batch. Every block
+// must arrive exactly once with its payload intact, in private, elastic,
+// multi-lane and shared queues.
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "ring_queue.h"
+
+LogManager* g_log_manager;
+
+struct StressConfig {
+    const char* name;
+    int producers;
+    int consumers;
+    size_t blocks_per_producer;
+    size_t queue_size;
+    std::vector<int> lane_weights;
+    bool shared;
+    size_t segment_size;
+};
+
+// Payload of block `sequence` from `producer`: its number, then filler derived from it
+static size_t make_block(char* data, uint32_t producer, uint32_t sequence) {
+    size_t length = 8 + (sequence * 7 + producer) % 120;
+    std::memcpy(data, &producer, 4);
+    std::memcpy(data + 4, &sequence, 4);
+    for (size_t i = 8; i < length; ++i) {
+        data[i] = (char)(producer + sequence + i);
+    }
+    return length;
+}
+
+class Tracker {
+public:
+    Tracker(int producers, size_t blocks_per_producer)
+        : blocks_per_producer_(blocks_per_producer), seen_(producers * blocks_per_producer),
+          received_(0), duplicates_(0), corrupted_(0) {}
+
+    void receive(const char* data, size_t length, const QueueBlock& header) {
+        uint32_t producer;
+        uint32_t sequence;
+        if (length < 8) {
+            corrupted_.fetch_add(1);
+            return;
+        }
+        std::memcpy(&producer, data, 4);
+        std::memcpy(&sequence, data + 4, 4);
+        char expected[128];
+        size_t index = producer * blocks_per_producer_ + sequence;
+        if (index >= seen_.size() || make_block(expected, producer, sequence) != length ||
+            std::memcmp(expected, data, length) != 0 || header.connection != producer || header.sequence != sequence) {
+            corrupted_.fetch_add(1);
+            return;
+        }
+        if (seen_[index].exchange(1) != 0) {
+            duplicates_.fetch_add(1);
+        }
+        received_.fetch_add(1);
+    }
+
+    size_t received() const { return received_.load(); }
+    size_t duplicates() const { return duplicates_.load(); }
+    size_t corrupted() const { return corrupted_.load(); }
+    size_t missing() const {
+        size_t missing = 0;
+        for (const auto& seen : seen_) {
+            missing += seen.load() == 0;
+        }
+        return missing;
+    }
+
+private:
+    size_t blocks_per_producer_;
+    std::vector<std::atomic<uint8_t>> seen_;
+    std::atomic<size_t> received_;
+    std::atomic<size_t> duplicates_;
+    std::atomic<size_t> corrupted_;
+};
+
+static QueueBlock header_for(uint32_t producer, uint32_t sequence, size_t lanes) {
+    QueueBlock header = QueueBlock();
+    header.connection = producer;
+    header.sequence = sequence;
+    header.type = BlockType::Data;
+    header.lane = (uint8_t)(sequence % lanes);
+    return header;
+}
+
+// Each producer cycles through the three ways of pushing, retrying while the queue is full
+static void produce(RingQueue& queue, uint32_t producer, size_t count, size_t lanes) {
+    uint32_t sequence = 0;
+    while (sequence < count) {
+        uint32_t before = sequence;
+        char data[8][128];
+        switch ((sequence / 8 + producer) % 3) {
+        case 0: {
+            size_t length = make_block(data[0], producer, sequence);
+            if (queue.push(data[0], length, header_for(producer, sequence, lanes))) {
+                ++sequence;
+            }
+            break;
+        }
+        case 1: {
+            // A batch holds blocks of one lane
+            QueueBlock headers[8];
+            const char* pointers[8];
+            size_t lengths[8];
+            size_t batch = 0;
+            uint32_t first_lane = sequence % lanes;
+            while (batch < 8 && sequence + batch < count && (sequence + batch) % lanes == first_lane) {
+                headers[batch] = header_for(producer, sequence + batch, lanes);
+                lengths[batch] = make_block(data[batch], producer, sequence + batch);
+                pointers[batch] = data[batch];
+                ++batch;
+            }
+            sequence += queue.push_batch(headers, pointers, lengths, batch);
+            break;
+        }
+        default: {
+            QueueReservation reservation;
+            QueueBlock header = header_for(producer, sequence, lanes);
+            if (queue.reserve(128, header.lane, reservation)) {
+                size_t length = make_block(reservation.data, producer, sequence);
+                queue.commit(reservation, header, length);
+                ++sequence;
+            }
+            break;
+        }
+        }
+        if (sequence == before) {
+            std::this_thread::yield();  // Full, let the consumers drain it
+        }
+    }
+}
+
+// Each consumer uses one of the four ways of consuming until every block arrived
+static void consume(RingQueue& queue, Tracker& tracker, size_t expected, int mode) {
+    const std::chrono::milliseconds timeout(10);
+    std::vector<char> buffer(64 * 128);
+    while (tracker.received() < expected) {
+        switch (mode % 4) {
+        case 0: {
+            QueueBlock header;
+            size_t length = 0;
+            if (queue.wait_and_pop(buffer.data(), buffer.size(), length, header, timeout)) {
+                tracker.receive(buffer.data(), length, header);
+            }
+            break;
+        }
+        case 1: {
+            QueueBlock headers[16];
+            size_t lengths[16];
+            size_t popped = queue.pop_batch(buffer.data(), buffer.size(), headers, lengths, 16, timeout);
+            size_t offset = 0;
+            for (size_t i = 0; i < popped; ++i) {
+                tracker.receive(buffer.data() + offset, lengths[i], headers[i]);
+                offset += lengths[i];
+            }
+            break;
+        }
+        case 2: {
+            QueueSpan span;
+            QueueBlock header;
+            if (queue.peek(span, header, timeout)) {
+                tracker.receive(span.data, span.length, header);
+                queue.release(span);
+            }
+            break;
+        }
+        default: {
+            QueueSpan spans[16];
+            QueueBlock headers[16];
+            size_t claimed = queue.peek_batch(spans, headers, 16, timeout);
+            // Release out of order, the ring must still reclaim the space
+            for (size_t i = claimed; i > 0; --i) {
+                tracker.receive(spans[i - 1].data, spans[i - 1].length, headers[i - 1]);
+                queue.release(spans[i - 1]);
+            }
+            break;
+        }
+        }
+    }
+}
+
+static void run_stress(const StressConfig& config) {
+    std::unique_ptr<RingQueue> queue(new RingQueue(config.queue_size, config.lane_weights, config.shared, config.segment_size));
+    queue->set_wait_policy(16, 16);
+    size_t lanes = queue->lanes();
+    size_t expected = config.producers * config.blocks_per_producer;
+    Tracker tracker(config.producers, config.blocks_per_producer);
+
+    std::vector<std::thread> threads;
+    for (int i = 0; i < config.consumers; ++i) {
+        threads.emplace_back(consume, std::ref(*queue), std::ref(tracker), expected, i);
+    }
+    for (int i = 0; i < config.producers; ++i) {
+        threads.emplace_back(produce, std::ref(*queue), (uint32_t)i, config.blocks_per_producer, lanes);
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    std::printf("  %-28s received %zu/%zu duplicates %zu corrupted %zu missing %zu\n", config.name,
+                tracker.received(), expected, tracker.duplicates(), tracker.corrupted(), tracker.missing());
+    CHECK(tracker.received() == expected);
+    CHECK(tracker.duplicates() == 0);
+    CHECK(tracker.corrupted() == 0);
+    CHECK(tracker.missing() == 0);
+    CHECK(queue->size() == 0);
+}
+
+// A QueueBatch flushed into a full queue keeps the blocks that did not fit, in order
+static void check_batch_backpressure() {
+    RingQueue queue(4 * 1024);
+    QueueBatch batch(queue);
+    char data[64] = {};
+    size_t added = 0;
+    while (added < QUEUE_BATCH_CAPACITY) {
+        CHECK(batch.add(data, sizeof(data), header_for(0, (uint32_t)added, 1)));
+        ++added;
+    }
+    size_t pushed = batch.flush();
+    CHECK(pushed > 0 && pushed < added);
+    CHECK(batch.size() == added - pushed);
+
+    // Refill the batch, once it is full and cannot push it refuses new blocks instead of losing them
+    while (batch.size() < QUEUE_BATCH_CAPACITY) {
+        CHECK(batch.add(data, sizeof(data), header_for(0, (uint32_t)added, 1)));
+        ++added;
+    }
+    CHECK(!batch.add(data, sizeof(data), header_for(0, (uint32_t)added, 1)));
+
+    QueueBlock header;
+    size_t actual_length;
+    char buffer[256];
+    uint32_t next = 0;
+    while (batch.size() > 0 || queue.size() > 0) {
+        while (queue.wait_and_pop(buffer, sizeof(buffer), actual_length, header, std::chrono::milliseconds(0))) {
+            CHECK(header.sequence == next);
+            ++next;
+        }
+        batch.flush();
+    }
+    CHECK(next == added);
+    std::printf("  %-28s pushed %zu of %zu before the queue filled, the rest after draining\n",
+                "batch into a full queue", pushed, added);
+}
+
+// A claim made with an intent is published there, so a dead consumer's claim can be found
+static void check_claim_intent() {
+    RingQueue queue(16 * 1024);
+    char data[64] = {};
+    for (uint32_t i = 0; i < 10; ++i) {
+        CHECK(queue.push(data, sizeof(data), header_for(0, i, 1)));
+    }
+    ClaimIntent intent;
+    intent.start = NO_CLAIM;
+    QueueSpan spans[4];
+    QueueBlock headers[4];
+    size_t claimed = queue.peek_batch(spans, headers, 4, std::chrono::milliseconds(0), &intent);
+    CHECK(claimed == 4);
+    CHECK(intent.start.load() != NO_CLAIM && intent.start.load() <= spans[0].position);
+    CHECK(intent.lane.load() == spans[0].lane && intent.count.load() == claimed);
+    CHECK(queue.is_claimed(intent.lane.load(), intent.start.load()));
+
+    // The next claim starts where this one ended
+    QueueSpan next;
+    QueueBlock next_header;
+    CHECK(queue.peek_batch(&next, &next_header, 1, std::chrono::milliseconds(0), &intent) == 1);
+    CHECK(intent.start.load() == spans[claimed - 1].position + sizeof(QueueBlock) + spans[claimed - 1].length);
+    for (size_t i = 0; i < claimed; ++i) {
+        queue.release(spans[i]);
+    }
+    CHECK(!queue.is_claimed(spans[0].lane, spans[0].position));
+    CHECK(queue.is_claimed(next.lane, next.position));
+    queue.release(next);
+    CHECK(!queue.is_claimed(next.lane, next.position));
+    std::printf("  %-28s published before read_head moved\n", "claim intent");
+}
+
+// A queue whose memory cannot be mapped reports it instead of crashing on first use
+static void check_allocation_failure() {
+    RingQueue too_large((size_t)1 << 50, std::vector<int>(1, 1), true);
+    CHECK(!too_large.valid());
+    RingQueue queue(16 * 1024, std::vector<int>(1, 1), true);
+    CHECK(queue.valid());
+    std::printf("  %-28s reported as invalid\n", "unmappable queue");
+}
+
+int main() {
+    init_test_log(LogLevel::Critical);
+
+    // Small queues keep producers running into a full ring and consumers into an empty one
+    StressConfig configs[] = {
+        {"1 producer, 1 consumer", 1, 1, 20000, 16 * 1024, {1}, false, 0},
+        {"1 producer, 8 consumers", 1, 8, 40000, 16 * 1024, {1}, false, 0},
+        {"4 producers, 4 consumers", 4, 4, 20000, 16 * 1024, {1}, false, 0},
+        {"8 producers, 16 consumers", 8, 16, 5000, 32 * 1024, {1}, false, 0},
+        {"4x4, three lanes", 4, 4, 20000, 48 * 1024, {4, 2, 1}, false, 0},
+        {"4x4, elastic segments", 4, 4, 20000, 256 * 1024, {1}, false, 8 * 1024},
+        {"4x4, shared mapping", 4, 4, 20000, 64 * 1024, {1}, true, 0},
+    };
+    for (const StressConfig& config : configs) {
+        run_stress(config);
+    }
+    check_batch_backpressure();
+    check_claim_intent();
+    check_allocation_failure();
+    return test_result("ring_queue_test");
+}
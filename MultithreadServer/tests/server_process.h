@@ -0,0 +1,147 @@
+#ifndef SERVER_PROCESS_H
+#define SERVER_PROCESS_H
+
+#include <arpa/inet.h>
+#include <climits>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+
+// Runs ../mulserver in the foreground with the given extra configuration and
+// one TCP bind on 127.0.0.1, for tests that need the whole request path.
+// The configuration, bind file and logs go to a scratch directory. An empty
+// `handler` runs the handler linked into `binary`, for a static build.
+class ServerProcess {
+public:
+    ServerProcess(const std::string& config, const std::string& handler, const std::string& binary = "../mulserver")
+        : pid_(-1), port_((uint16_t)(20000 + getpid() % 20000)) {
+        char directory[] = "/tmp/mulserver_test_XXXXXX";
+        if (!mkdtemp(directory)) {
+            return;
+        }
+        directory_ = directory;
+        write_file(directory_ + "/bind.txt", "127.0.0.1 " + std::to_string(port_) + " tcp 60\n");
+        write_file(directory_ + "/config.ini", "log_dir = " + directory_ + "\nlog_dest = 2\nlog_level = 4\n"
+                   "bind_file = " + directory_ + "/bind.txt\n" + config);
+
+        char handler_path[PATH_MAX] = "";
+        if (!handler.empty() && !realpath(handler.c_str(), handler_path)) {
+            std::fprintf(stderr, "handler %s not found\n", handler.c_str());
+            return;
+        }
+        std::fflush(stdout);  // The child would write out the parent's buffered output again
+        pid_ = fork();
+        if (pid_ == 0) {
+            // Keep the server's start-up chatter out of the test output
+            FILE* output = std::freopen((directory_ + "/server.out").c_str(), "w", stdout);
+            if (output) {
+                dup2(fileno(output), STDERR_FILENO);
+            }
+            std::string config_path = directory_ + "/config.ini";
+            execl(binary.c_str(), binary.c_str(), config_path.c_str(), handler.empty() ? nullptr : handler_path, (char*)nullptr);
+            _exit(127);
+        }
+    }
+
+    ~ServerProcess() {
+        if (pid_ > 0) {
+            kill(pid_, SIGKILL);
+            waitpid(pid_, nullptr, 0);
+        }
+        if (!directory_.empty()) {
+            std::string command = "rm -rf " + directory_;
+            if (std::system(command.c_str()) != 0) {
+                std::fprintf(stderr, "failed to remove %s\n", directory_.c_str());
+            }
+        }
+    }
+
+    pid_t pid() const { return pid_; }
+
+    // True while the server process has not exited
+    bool running() const {
+        return pid_ > 0 && waitpid(pid_, nullptr, WNOHANG) == 0;
+    }
+
+    // Connect to the bind, retrying every `retry_ms` for 5 seconds while the server starts up.
+    // Returns the socket or -1.
+    int connect_client(int retry_ms = 50) const {
+        for (int attempt = 0; attempt < 5000 / retry_ms && running(); ++attempt) {
+            int fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address = sockaddr_in();
+            address.sin_family = AF_INET;
+            address.sin_port = htons(port_);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            if (connect(fd, (sockaddr*)&address, sizeof(address)) == 0) {
+                timeval timeout = {5, 0};
+                setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                return fd;
+            }
+            close(fd);
+            std::this_thread::sleep_for(std::chrono::milliseconds(retry_ms));
+        }
+        return -1;
+    }
+
+    // Lines of the server's log files containing `text`
+    int log_count(const std::string& text) const {
+        std::string command = "cat " + directory_ + "/log_* 2>/dev/null | grep -c -F '" + text + "'";
+        FILE* output = popen(command.c_str(), "r");
+        int count = 0;
+        if (output) {
+            if (std::fscanf(output, "%d", &count) != 1) {
+                count = 0;
+            }
+            pclose(output);
+        }
+        return count;
+    }
+
+private:
+    static void write_file(const std::string& path, const std::string& content) {
+        FILE* file = std::fopen(path.c_str(), "w");
+        if (file) {
+            std::fputs(content.c_str(), file);
+            std::fclose(file);
+        }
+    }
+
+    pid_t pid_;
+    uint16_t port_;
+    std::string directory_;
+};
+
+// Send all of `length` bytes, false on error
+inline bool send_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+// Receive exactly `length` bytes, false on error, timeout or close
+inline bool recv_all(int fd, char* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(fd, data, length, 0);
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        length -= received;
+    }
+    return true;
+}
+
+#endif // SERVER_PROCESS_H
@@ -0,0 +1,150 @@
+// Start-up benchmark of the queue memory policy: with huge pages off,
+// transparent and explicit, and with and without prefaulting, measures the
+// time from starting the server to the first answered request, then a first
+// pass of requests through the untouched receive and send queues. The data TLB
+// misses of the server threads during that pass are read from perf events
+// where the kernel allows it, "n/a" otherwise.
+#include <dirent.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <chrono>
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t FRAME_SIZE = 8000;               // Inline, the frames are copied through the queues
+constexpr size_t QUEUE_LENGTH = 256 * 1024 * 1024;
+
+// Data TLB read misses of every thread of a process, counted from start() on
+class TlbCounter {
+public:
+    explicit TlbCounter(pid_t pid) {
+        std::string path = "/proc/" + std::to_string(pid) + "/task";
+        DIR* tasks = opendir(path.c_str());
+        if (!tasks) {
+            return;
+        }
+        while (dirent* entry = readdir(tasks)) {
+            if (entry->d_name[0] == '.') {
+                continue;
+            }
+            perf_event_attr attr = perf_event_attr();
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HW_CACHE;
+            attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            attr.disabled = 1;
+            attr.exclude_kernel = 1;
+            int fd = (int)syscall(SYS_perf_event_open, &attr, atoi(entry->d_name), -1, -1, 0);
+            if (fd >= 0) {
+                fds_.push_back(fd);
+            }
+        }
+        closedir(tasks);
+    }
+
+    ~TlbCounter() {
+        for (int fd : fds_) {
+            close(fd);
+        }
+    }
+
+    void start() {
+        for (int fd : fds_) {
+            ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+
+    // Misses since start(), -1 without counters
+    long long stop() {
+        if (fds_.empty()) {
+            return -1;
+        }
+        long long total = 0;
+        for (int fd : fds_) {
+            long long count = 0;
+            ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(fd, &count, sizeof(count)) == (ssize_t)sizeof(count)) {
+                total += count;
+            }
+        }
+        return total;
+    }
+
+private:
+    std::vector<int> fds_;
+};
+
+struct Result {
+    double first_request_ms;
+    double first_pass_ms;
+    long long tlb_misses;
+};
+
+static double milliseconds_since(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+static bool run(int huge_pages, int prefault, size_t requests, Result& result) {
+    std::vector<char> frame(FRAME_SIZE, 'x');
+    uint32_t length = FRAME_SIZE;
+    std::memcpy(frame.data(), &length, sizeof(length));
+    std::vector<char> response(frame.size());
+
+    auto start = std::chrono::steady_clock::now();
+    ServerProcess server("max_packet_size = 16384\nworker_num = 2\nringqueue_segment = 0\nringqueue_length = " +
+                         std::to_string(QUEUE_LENGTH) + "\nhuge_pages = " + std::to_string(huge_pages) +
+                         "\nmem_prefault = " + std::to_string(prefault) + "\n", "libtest_handler.so");
+    int fd = server.connect_client(1);
+    if (fd < 0 || !send_all(fd, frame.data(), frame.size()) || !recv_all(fd, response.data(), response.size())) {
+        return false;
+    }
+    result.first_request_ms = milliseconds_since(start);
+
+    // One request at a time, every frame lands on queue memory not written before
+    TlbCounter tlb(server.pid());
+    tlb.start();
+    auto pass_start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < requests; ++i) {
+        if (!send_all(fd, frame.data(), frame.size()) || !recv_all(fd, response.data(), response.size())) {
+            return false;
+        }
+    }
+    result.first_pass_ms = milliseconds_since(pass_start);
+    result.tlb_misses = tlb.stop();
+    close(fd);
+    return server.running();
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    // By default the pass covers a quarter of each queue
+    size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : QUEUE_LENGTH / 4 / FRAME_SIZE;
+    std::printf("startup_bench: %zu MB queues, first pass of %zu requests of %zu bytes\n",
+                QUEUE_LENGTH >> 20, requests, FRAME_SIZE);
+    std::printf("%-24s %18s %16s %14s\n", "memory", "first request ms", "first pass ms", "dTLB misses");
+    const struct {
+        const char* name;
+        int huge_pages;
+        int prefault;
+    } policies[] = {{"regular pages", 0, 0},
+                    {"regular, prefaulted", 0, 1},
+                    {"transparent huge pages", 1, 0},
+                    {"transparent, prefaulted", 1, 1},
+                    {"explicit huge pages", 2, 1}};
+    for (const auto& policy : policies) {
+        Result result = Result();
+        bool completed = run(policy.huge_pages, policy.prefault, requests, result);
+        CHECK(completed);
+        char misses[32] = "n/a";
+        if (result.tlb_misses >= 0) {
+            std::snprintf(misses, sizeof(misses), "%lld", result.tlb_misses);
+        }
+        std::printf("%-24s %18.1f %16.1f %14s\n", policy.name, result.first_request_ms, result.first_pass_ms, misses);
+    }
+    return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,203 @@
+// Skewed-load benchmark of the stealing worker mode: 1% of the connections send
+// half of the requests, each connection sticks to one worker queue as the
+// affinity dispatch places it. Compares workers that only serve their own queue,
+// stealing one block per claim, and stealing a batch per claim, by throughput and
+// by p50/p99 of the time from push to completion. A connection's requests must
+// still complete in order, the benchmark counts any that do not.
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "ring_queue.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t MESSAGE_SIZE = 64;
+constexpr size_t QUEUE_SIZE = 1 << 22;
+constexpr uint32_t CONNECTIONS = 1000;
+constexpr uint32_t HOT_CONNECTIONS = CONNECTIONS / 100;
+constexpr size_t STEAL_BATCH = 8;
+
+enum class StealMode { None, OneBlock, Batch };
+
+// Per-connection state shared by the workers: the inflight flag of ordered
+// connections and the last sequence completed, to catch reordering
+struct Connection {
+    std::atomic<uint8_t> inflight;
+    uint32_t worker;
+    uint32_t completed;
+};
+
+// Same contract as the server's InflightGuard
+class ConnectionGuard : public BlockGuard {
+public:
+    explicit ConnectionGuard(std::vector<Connection>& connections) : connections_(connections) {}
+
+    bool try_acquire(const QueueBlock& block_header) override {
+        uint8_t expected = 0;
+        return connections_[block_header.connection].inflight.compare_exchange_strong(expected, 1, std::memory_order_acq_rel);
+    }
+
+    void release(const QueueBlock& block_header) override {
+        connections_[block_header.connection].inflight.store(0, std::memory_order_release);
+    }
+
+private:
+    std::vector<Connection>& connections_;
+};
+
+struct Result {
+    double requests_per_second;
+    uint32_t p50;
+    uint32_t p99;
+    size_t stolen;
+    size_t reordered;
+};
+
+static void serve(uint32_t service_us) {
+    uint32_t start = queue_clock();
+    while (queue_clock() - start < service_us) {
+    }
+}
+
+static Result run(int workers, size_t requests, uint32_t service_us, StealMode mode) {
+    std::vector<std::unique_ptr<RingQueue>> queues;
+    for (int i = 0; i < workers; ++i) {
+        queues.emplace_back(new RingQueue(QUEUE_SIZE));
+    }
+    std::vector<Connection> connections(CONNECTIONS);
+    std::mt19937 placement(7);
+    for (auto& connection : connections) {
+        connection.inflight = 0;
+        connection.worker = placement() % workers;
+        connection.completed = 0;
+    }
+
+    std::atomic<size_t> done(0);
+    std::atomic<size_t> stolen(0);
+    std::atomic<size_t> reordered(0);
+    std::vector<std::vector<uint32_t>> latencies(workers);
+
+    auto complete = [&](const QueueBlock& block, std::vector<uint32_t>& latency) {
+        serve(service_us);
+        Connection& connection = connections[block.connection];
+        if (block.sequence != connection.completed + 1) {
+            reordered.fetch_add(1, std::memory_order_relaxed);
+        }
+        connection.completed = block.sequence;
+        latency.push_back(queue_clock() - block.timestamp);
+    };
+
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (int worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&, worker] {
+            ConnectionGuard guard(connections);
+            RingQueue& own = *queues[worker];
+            std::vector<uint32_t>& latency = latencies[worker];
+            latency.reserve(requests);
+            QueueSpan spans[STEAL_BATCH];
+            QueueBlock blocks[STEAL_BATCH];
+            while (done.load(std::memory_order_relaxed) < requests) {
+                if (own.try_peek(spans[0], blocks[0], &guard)) {
+                    complete(blocks[0], latency);
+                    own.release(spans[0]);
+                    guard.release(blocks[0]);
+                    done.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                RingQueue* victim = nullptr;
+                size_t victim_size = 0;
+                for (int i = 0; mode != StealMode::None && i < workers; ++i) {
+                    size_t queued = queues[i]->size();
+                    if (i != worker && queued > victim_size) {
+                        victim = queues[i].get();
+                        victim_size = queued;
+                    }
+                }
+                size_t count = 0;
+                if (victim && mode == StealMode::OneBlock) {
+                    while (count < STEAL_BATCH && victim->try_peek(spans[0], blocks[0], &guard)) {
+                        complete(blocks[0], latency);
+                        victim->release(spans[0]);
+                        guard.release(blocks[0]);
+                        ++count;
+                    }
+                } else if (victim && mode == StealMode::Batch) {
+                    count = victim->try_peek_batch(spans, blocks, STEAL_BATCH, &guard);
+                    for (size_t i = 0; i < count; ++i) {
+                        complete(blocks[i], latency);
+                        victim->release(spans[i]);
+                        bool last = true;
+                        for (size_t j = i + 1; j < count; ++j) {
+                            last = last && blocks[j].connection != blocks[i].connection;
+                        }
+                        if (last) {
+                            guard.release(blocks[i]);
+                        }
+                    }
+                }
+                if (count > 0) {
+                    stolen.fetch_add(count, std::memory_order_relaxed);
+                    done.fetch_add(count, std::memory_order_relaxed);
+                    continue;
+                }
+                own.wait_for_data(std::chrono::milliseconds(1));
+            }
+        });
+    }
+
+    // The network thread: half of the requests come from the hot connections
+    std::mt19937 traffic(11);
+    std::vector<uint32_t> sequences(CONNECTIONS, 0);
+    char data[MESSAGE_SIZE] = {};
+    for (size_t i = 0; i < requests; ++i) {
+        uint32_t connection = (traffic() & 1) ? traffic() % HOT_CONNECTIONS
+                                              : HOT_CONNECTIONS + traffic() % (CONNECTIONS - HOT_CONNECTIONS);
+        QueueBlock header = QueueBlock();
+        header.type = BlockType::Data;
+        header.connection = connection;
+        header.sequence = ++sequences[connection];
+        header.timestamp = queue_clock();
+        while (!queues[connections[connection].worker]->push(data, sizeof(data), header)) {
+            std::this_thread::yield();
+        }
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    std::vector<uint32_t> all;
+    for (auto& latency : latencies) {
+        all.insert(all.end(), latency.begin(), latency.end());
+    }
+    std::sort(all.begin(), all.end());
+    return {requests / seconds, all[all.size() / 2], all[all.size() * 99 / 100], stolen.load(), reordered.load()};
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    size_t requests = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 200000;
+    uint32_t service_us = argc > 2 ? (uint32_t)std::strtoul(argv[2], nullptr, 10) : 2;
+    std::printf("steal_bench: %zu requests of %zu bytes, %u connections, %u of them send half, %u us each, %u hardware threads\n",
+                requests, MESSAGE_SIZE, CONNECTIONS, HOT_CONNECTIONS, service_us, std::thread::hardware_concurrency());
+    std::printf("%-9s %-22s %14s %10s %10s %10s\n", "workers", "mode", "requests/s", "p50 us", "p99 us", "stolen");
+    const struct {
+        StealMode mode;
+        const char* name;
+    } modes[] = {{StealMode::None, "own queue only"}, {StealMode::OneBlock, "steal one per claim"}, {StealMode::Batch, "steal batch of 8"}};
+    for (int workers : {2, 4, 8}) {
+        for (const auto& mode : modes) {
+            Result result = run(workers, requests, service_us, mode.mode);
+            CHECK(result.reordered == 0);
+            std::printf("%-9d %-22s %14.0f %10u %10u %10zu\n", workers, mode.name, result.requests_per_second,
+                        result.p50, result.p99, result.stolen);
+        }
+    }
+    return g_test_failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,44 @@
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include "log_manager.h"
+
+// Record a failed expectation and keep going, main() returns the failure count
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            ++g_test_failures; \
+        } \
+    } while (0)
+
+static int g_test_failures = 0;
+
+// Errors only by default, the server code logs every connection at Info. Tests
+// that fill queues on purpose pass Critical, a full queue is logged as an error.
+inline void init_test_log(LogLevel level = LogLevel::Error) {
+    g_log_manager = new LogManager(".", (int) level, 1, 1 << 20, LogDestination::Terminal);
+}
+
+// Resident set size of this process
+inline size_t resident_bytes() {
+    size_t pages = 0, resident = 0;
+    FILE* statm = std::fopen("/proc/self/statm", "r");
+    if (statm) {
+        if (std::fscanf(statm, "%zu %zu", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        std::fclose(statm);
+    }
+    return resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+inline int test_result(const char* name) {
+    std::printf("%s: %s\n", name, g_test_failures == 0 ? "PASS" : "FAIL");
+    return g_test_failures == 0 ? 0 : 1;
+}
+
+#endif // TEST_COMMON_H
@@ -0,0 +1,111 @@
+// Benchmark of worker_mode = process against worker_mode = thread. Worker
+// processes share the queues with the server through shared memory and wake
+// through shared futexes, in-process workers use private mappings and futexes.
+// Measures the p50/p99 round trip of one request at a time on one connection,
+// then the throughput of several connections with one request in flight each,
+// with small inline frames and with frames large enough to go out of line.
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include "test_common.h"
+#include "server_process.h"
+
+LogManager* g_log_manager;
+
+constexpr size_t SMALL_FRAME = 64;
+constexpr size_t LARGE_FRAME = 64 * 1024;       // Above DEFAULT_INLINE_PAYLOAD, carried as a payload
+constexpr int CONNECTIONS = 8;
+
+struct Result {
+    uint32_t p50;
+    uint32_t p99;
+    double requests_per_second;
+};
+
+// Send one frame and wait for its echo. The sample handler frames by a leading 32-bit total length.
+static bool round_trip(int fd, std::vector<char>& frame, std::vector<char>& response) {
+    return send_all(fd, frame.data(), frame.size()) && recv_all(fd, response.data(), response.size()) &&
+           frame == response;
+}
+
+static bool run(const char* mode, size_t frame_size, size_t round_trips, size_t requests, Result& result) {
+    ServerProcess server(std::string("max_packet_size = 131072\nworker_num = 2\nworker_mode = ") + mode + "\n",
+                         "libtest_handler.so");
+    int fds[CONNECTIONS];
+    for (int& fd : fds) {
+        fd = server.connect_client();
+        if (fd < 0) {
+            return false;
+        }
+    }
+    std::vector<char> frame(frame_size, 'x');
+    uint32_t length = (uint32_t)frame_size;
+    std::memcpy(frame.data(), &length, sizeof(length));
+
+    // One request at a time
+    std::vector<char> response(frame_size);
+    std::vector<uint32_t> latencies;
+    latencies.reserve(round_trips);
+    for (size_t i = 0; i < round_trips; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        if (!round_trip(fds[0], frame, response)) {
+            return false;
+        }
+        latencies.push_back((uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    result.p50 = latencies[latencies.size() / 2];
+    result.p99 = latencies[latencies.size() * 99 / 100];
+
+    // Every connection has a client thread keeping one request in flight
+    std::atomic<size_t> failed(0);
+    std::vector<std::thread> clients;
+    auto start = std::chrono::steady_clock::now();
+    for (int fd : fds) {
+        clients.emplace_back([&, fd] {
+            std::vector<char> echo(frame_size);
+            for (size_t i = 0; i < requests / CONNECTIONS; ++i) {
+                if (!round_trip(fd, frame, echo)) {
+                    failed.fetch_add(1);
+                    return;
+                }
+            }
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    result.requests_per_second = requests / CONNECTIONS * CONNECTIONS / seconds;
+    for (int fd : fds) {
+        close(fd);
+    }
+    return failed.load() == 0 && server.running();
+}
+
+int main(int argc, char** argv) {
+    init_test_log(LogLevel::Critical);
+    size_t round_trips = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    size_t requests = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+    std::printf("worker_bench: %zu round trips, %zu requests on %d connections, %u hardware threads\n",
+                round_trips, requests, CONNECTIONS, std::thread::hardware_concurrency());
+    std::printf("%-10s %10s %10s %10s %14s\n", "workers", "frame", "p50 us", "p99 us", "requests/s");
+    // Large frames run a tenth of the requests, each moves a thousand times the bytes
+    const struct {
+        size_t size;
+        size_t divisor;
+    } frames[] = {{SMALL_FRAME, 1}, {LARGE_FRAME, 10}};
+    for (const auto& frame : frames) {
+        for (const char* mode : {"thread", "process"}) {
+            Result result = Result();
+            bool completed = run(mode, frame.size, round_trips / frame.divisor, requests / frame.divisor, result);
+            CHECK(completed);
+            std::printf("%-10s %10zu %10u %10u %14.0f\n", mode, frame.size, result.p50, result.p99,
+                        result.requests_per_second);
+        }
+    }
+    return g_test_failures == 0 ? 0 : 1;
+}
@@ -8,6 +8,7 @@
 #define GetCurrentDir getcwd
 #endif
 
+#include <algorithm>
 #include <iostream>
 
 #define MAX_PATH_LENGTH 1024
@@ -0,0 +1,34 @@
+// Example handler written as coroutines: every frame is looked up in a
+// simulated asynchronous backend and echoed back once the lookup completes.
+#include "server_coroutine.h"
+#include <chrono>
+#include <functional>
+#include <thread>
+
+// Stand-in for an asynchronous client library that completes on its own thread
+static void backend_lookup(const std::string& key, std::function<void(std::string)> done) {
+    std::thread([key, done]() {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        done(key);
+    }).detach();
+}
+
+static server::Task echo_request(server::Request request) {
+    std::string value = co_await server::upstream<std::string>([&request](server::Completion<std::string> done) {
+        backend_lookup(request.data(), done);
+    });
+    co_await request.reply(value);
+}
+
+SERVER_COROUTINE_HANDLER(echo_request)
+
+extern "C" EXPORT_SYMBOL int handle_input_from_client(const char* receive_buffer, int receive_buffer_len, const SocketInfo* si) {
+    (void)si;
+    if (receive_buffer_len > (int)sizeof(uint32_t)) {
+        uint32_t len = *((uint32_t*)receive_buffer);
+        if ((uint32_t)receive_buffer_len >= len) {
+            return len;
+        }
+    }
+    return 0;
+}
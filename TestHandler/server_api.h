@@ -1,8 +1,6 @@
 #ifndef SERVER_API_H
 #define SERVER_API_H
 
-#include <string>
-
 #ifdef _WIN32
     #define WEAK_SYMBOL __declspec(selectany)
     #define EXPORT_SYMBOL __declspec(dllexport)
@@ -14,72 +12,69 @@
     #define EXPORT_SYMBOL __attribute__((visibility("default")))
 #endif
 
-enum class LogLevel {
-    Emergency = 0,
-    Alert,
-    Critical,
-    Error,
-    Warning,
-    Notice,
-    Info,
-    Debug,
-    Trace
-};
-
-enum class LogDestination {
-    Terminal = 1,
-    File = 2,
-    Both = 3
-};
-
-class LogManager {
-public:
-    WEAK_SYMBOL void log_message(LogLevel level, const char* format, ...);
-};
-
-// Define macros to make logging simpler
-#define LOG_EMERG(fmt, ...)   g_log_manager->log_message(LogLevel::Emergency, fmt, ##__VA_ARGS__)
-#define LOG_ALERT(fmt, ...)   g_log_manager->log_message(LogLevel::Alert, fmt, ##__VA_ARGS__)
-#define LOG_CRIT(fmt, ...)    g_log_manager->log_message(LogLevel::Critical, fmt, ##__VA_ARGS__)
-#define LOG_ERR(fmt, ...)     g_log_manager->log_message(LogLevel::Error, fmt, ##__VA_ARGS__)
-#define LOG_WARN(fmt, ...)    g_log_manager->log_message(LogLevel::Warning, fmt, ##__VA_ARGS__)
-#define LOG_NOTICE(fmt, ...)  g_log_manager->log_message(LogLevel::Notice, fmt, ##__VA_ARGS__)
-#define LOG_INFO(fmt, ...)    g_log_manager->log_message(LogLevel::Info, fmt, ##__VA_ARGS__)
-#define LOG_DEBUG(fmt, ...)   g_log_manager->log_message(LogLevel::Debug, fmt, ##__VA_ARGS__)
-#define LOG_TRACE(fmt, ...)   g_log_manager->log_message(LogLevel::Trace, fmt, ##__VA_ARGS__)
+// The server's own declarations of its log and configuration managers and of
+// the types passed to handlers, shared with a handler linked into the server
+#include "../MultithreadServer/configuration_manager.h"
+#include "../MultithreadServer/handler_api.h"
+#include "../MultithreadServer/log_manager.h"
 
+// A handler may be loaded by a host without the server's log manager
 WEAK_SYMBOL extern LogManager* g_log_manager;
 
-class ConfigurationManager {
-public:
-    std::string get_string(const std::string& key, const std::string& default_value = "") const;
-    int get_integer(const std::string& key, int default_value) const;
-};
-
-struct SocketInfo {
-    int sock_fd;                // Socket file descriptor
-    int socket_type;            // Type of the socket
-    time_t recv_timestamp;      // Timestamp for when data was received
-    time_t send_timestamp;      // Timestamp for when data was sent
-
-    uint32_t local_ip;          // Local IP address
-    uint16_t local_port;        // Local port number
-    uint32_t remote_ip;         // Remote IP address
-    uint16_t remote_port;       // Remote port number
-};
-
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// Run on every thread at start, and again on every thread when the server reloads the library on SIGUSR1
 EXPORT_SYMBOL int handle_init(int argc, char** argv, int thread_type);
-EXPORT_SYMBOL int handle_input(const char* receive_buffer, int receive_buffer_len, const SocketInfo*);
-EXPORT_SYMBOL int handle_process(const char* queue_block_data, int data_len, char** send_data, int* send_data_len, const SocketInfo*);
-EXPORT_SYMBOL int handle_open(char** send_buffer, int* send_buffer_len, const SocketInfo*);
-EXPORT_SYMBOL int handle_close(const SocketInfo*);
+EXPORT_SYMBOL int handle_input_from_client(const char* receive_buffer, int receive_buffer_len, const SocketInfo*);
+// Optional: queue lane of a complete frame (0 is the most urgent), negative keeps the bind's lane
+EXPORT_SYMBOL int handle_input_priority(const char* frame, int frame_len, const SocketInfo*);
+// Optional: milliseconds the client waits for the response to a complete frame, negative uses pkg_timeout
+EXPORT_SYMBOL int handle_input_deadline(const char* frame, int frame_len, const SocketInfo*);
+// *send_data holds 8196 or data_len bytes, whichever is larger. A larger response points *send_data
+// at the handler's own memory, valid until the call returns, or is streamed with server_output_write.
+EXPORT_SYMBOL int handle_message_from_client(const char* queue_block_data, int data_len, char** send_data, int* send_data_len, const SocketInfo*);
+// Optional: process the requests popped together in one call, negative processes them one by one instead
+EXPORT_SYMBOL int handle_message_batch(batch_message_t* messages, int count);
+// Optional: fast-fail response to a request shed under overload, without it shed requests are dropped
+EXPORT_SYMBOL int handle_overload(const char* queue_block_data, int data_len, char** send_data, int* send_data_len, const SocketInfo*);
+EXPORT_SYMBOL int handle_client_open(char** send_buffer, int* send_buffer_len, const SocketInfo*);
+EXPORT_SYMBOL int handle_client_close(const SocketInfo*);
 EXPORT_SYMBOL int handle_timer(int* milliseconds);
+// Run when a thread stops or moves to a reloaded library, threads the handler started must stop here
 EXPORT_SYMBOL void handle_fini(int thread_type);
 
+// Optional context variants, exported instead of their plain counterparts. handle_thread_init
+// runs where handle_init would and may set thread->context, e.g. to a per-worker cache or
+// arena; the thread's input, message and batch callbacks receive it without any locking.
+// handle_thread_fini runs where handle_fini would and frees it.
+EXPORT_SYMBOL int handle_thread_init(int argc, char** argv, handler_thread_t* thread);
+EXPORT_SYMBOL int handle_input_context(handler_thread_t* thread, const char* receive_buffer, int receive_buffer_len, const SocketInfo*);
+EXPORT_SYMBOL int handle_message_context(handler_thread_t* thread, const char* queue_block_data, int data_len, char** send_data, int* send_data_len, const SocketInfo*);
+EXPORT_SYMBOL int handle_message_batch_context(handler_thread_t* thread, batch_message_t* messages, int count);
+EXPORT_SYMBOL void handle_thread_fini(handler_thread_t* thread);
+
+// Microseconds left until the deadline of the request being processed, 0 once it passed, -1 without one
+WEAK_SYMBOL int server_request_budget();
+// Handle of the request being processed, for a handler returning HANDLER_DEFERRED
+WEAK_SYMBOL request_handle_t server_request_handle();
+// Answer a deferred request from any thread, -1 if the send queue is full. Every deferred request must be answered.
+WEAK_SYMBOL int server_reply(request_handle_t handle, const char* data, int len);
+// Close the connection of a deferred request after the responses before it
+WEAK_SYMBOL int server_close(request_handle_t handle);
+// Queue a part of a deferred request's response, completed later by server_reply or server_close
+WEAK_SYMBOL int server_reply_part(request_handle_t handle, const char* data, int len);
+// Stream the response of the request being processed instead of filling send_data. Full chunks are
+// sent while the handler writes, send_data is appended when it returns. -1 outside handle_message_from_client.
+WEAK_SYMBOL char* server_output_reserve(int min_len, int* available);
+WEAK_SYMBOL int server_output_commit(int len);
+WEAK_SYMBOL int server_output_write(const char* data, int len);
+WEAK_SYMBOL int server_output_flush();
+// Run fn(arg) on a worker thread right away or after a delay, callable from any thread
+WEAK_SYMBOL int server_post(void (*fn)(void*), void* arg);
+WEAK_SYMBOL int server_post_after(int milliseconds, void (*fn)(void*), void* arg);
+
 #ifdef __cplusplus
 }
 #endif
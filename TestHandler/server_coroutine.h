@@ -0,0 +1,224 @@
+#ifndef SERVER_COROUTINE_H
+#define SERVER_COROUTINE_H
+
+// Coroutine handler interface on top of the server API, needs C++20.
+// A request handler is a coroutine taking a server::Request and returning a
+// server::Task:
+//
+//     server::Task handle_request(server::Request request) {
+//         std::string row = co_await server::upstream<std::string>([&](server::Completion<std::string> done) {
+//             db.get_async(request.data(), done);
+//         });
+//         co_await request.reply(row);
+//     }
+//     SERVER_COROUTINE_HANDLER(handle_request)
+//
+// The coroutine starts on the worker that dequeued the request and runs until
+// it first suspends. Every resumption is posted back to the worker pool, so a
+// suspended request holds no thread and a few workers serve thousands of them.
+
+#include <coroutine>
+#include <optional>
+#include <string>
+#include <utility>
+#include "server_api.h"
+
+namespace server {
+
+// Task callback resuming a coroutine on a worker thread
+inline void resume_coroutine(void* address) {
+    std::coroutine_handle<>::from_address(address).resume();
+}
+
+class Request;
+
+// Awaits until a response is queued, retrying while the send queue is full
+class ReplyAwaiter {
+public:
+    ReplyAwaiter(Request& request, const char* data, int len, bool close)
+        : request_(request), data_(data), len_(len), close_(close) {}
+
+    bool await_ready() { return try_send(); }
+    void await_suspend(std::coroutine_handle<> coroutine) {
+        coroutine_ = coroutine;
+        server_post_after(1, &ReplyAwaiter::retry, this);
+    }
+    void await_resume() {}
+
+private:
+    Request& request_;
+    const char* data_;
+    int len_;
+    bool close_;
+    std::coroutine_handle<> coroutine_;
+
+    inline bool try_send();
+
+    static void retry(void* self) {
+        ReplyAwaiter* awaiter = (ReplyAwaiter*)self;
+        if (awaiter->try_send()) {
+            awaiter->coroutine_.resume();
+        } else {
+            server_post_after(1, &ReplyAwaiter::retry, self);
+        }
+    }
+};
+
+// A request handled by a coroutine. The handler entry returns before the
+// coroutine completes and the queued request is released then, so the frame
+// and the connection metadata are copied. A request destroyed without an
+// answer gets an empty one, so the connection's later responses are not held.
+class Request {
+public:
+    Request(request_handle_t handle, const char* data, int len, const SocketInfo* si)
+        : handle_(handle), data_(data, len), socket_info_(*si), answered_(false) {}
+    Request(Request&& other) noexcept
+        : handle_(other.handle_), data_(std::move(other.data_)), socket_info_(other.socket_info_), answered_(other.answered_) {
+        other.answered_ = true;
+    }
+    Request(const Request&) = delete;
+    Request& operator=(const Request&) = delete;
+    ~Request() {
+        if (!answered_) {
+            answer_empty(new request_handle_t(handle_));
+        }
+    }
+
+    const std::string& data() const { return data_; }
+    const SocketInfo& socket_info() const { return socket_info_; }
+    request_handle_t handle() const { return handle_; }
+
+    // Queue the response, the data must stay valid until the co_await completes
+    ReplyAwaiter reply(const char* data, int len) { return ReplyAwaiter(*this, data, len, false); }
+    ReplyAwaiter reply(const std::string& data) { return ReplyAwaiter(*this, data.data(), (int)data.size(), false); }
+    // Close the connection once the responses before this request are sent
+    ReplyAwaiter close() { return ReplyAwaiter(*this, nullptr, 0, true); }
+
+private:
+    friend class ReplyAwaiter;
+    friend class Task;
+    request_handle_t handle_;
+    std::string data_;
+    SocketInfo socket_info_;
+    bool answered_;
+
+    static void answer_empty(void* handle) {
+        if (server_reply(*(request_handle_t*)handle, nullptr, 0) == 0) {
+            delete (request_handle_t*)handle;
+        } else {
+            server_post_after(1, &Request::answer_empty, handle);
+        }
+    }
+};
+
+inline bool ReplyAwaiter::try_send() {
+    int result = close_ ? server_close(request_.handle_) : server_reply(request_.handle_, data_, len_);
+    if (result == 0) {
+        request_.answered_ = true;
+    }
+    return result == 0;
+}
+
+// Return type of a coroutine handler. The coroutine runs detached and frees
+// itself when it completes. An exception escaping it closes the connection,
+// like a handler returning an error.
+class Task {
+public:
+    struct promise_type {
+        Request* request;
+
+        promise_type() : request(nullptr) {}
+        template <typename... Args>
+        promise_type(Request& handled, Args&...) : request(&handled) {}
+
+        Task get_return_object() noexcept { return Task(); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept {
+            if (request && server_close(request->handle()) == 0) {
+                request->answered_ = true;
+            }
+        }
+    };
+};
+
+// Awaits `milliseconds`, 0 lets the other ready work run first
+class SleepAwaiter {
+public:
+    explicit SleepAwaiter(int milliseconds) : milliseconds_(milliseconds) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine) {
+        server_post_after(milliseconds_, &resume_coroutine, coroutine.address());
+    }
+    void await_resume() const {}
+
+private:
+    int milliseconds_;
+};
+
+inline SleepAwaiter sleep(int milliseconds) {
+    return SleepAwaiter(milliseconds);
+}
+
+template <typename T>
+class Completion;
+
+// Awaits a value handed to a Completion from any thread, e.g. by the callback
+// of an asynchronous upstream client
+template <typename T, typename Start>
+class UpstreamAwaiter {
+public:
+    explicit UpstreamAwaiter(Start start) : start_(std::move(start)) {}
+
+    bool await_ready() const { return false; }
+    void await_suspend(std::coroutine_handle<> coroutine) {
+        // The completion may resume the coroutine before start returns, which
+        // destroys this awaiter, so start runs from a copy
+        Start start = std::move(start_);
+        start(Completion<T>(&value_, coroutine));
+    }
+    T await_resume() { return std::move(*value_); }
+
+private:
+    Start start_;
+    std::optional<T> value_;
+};
+
+// Delivers the result of an upstream call, to be invoked exactly once
+template <typename T>
+class Completion {
+public:
+    Completion(std::optional<T>* value, std::coroutine_handle<> coroutine) : value_(value), coroutine_(coroutine) {}
+
+    void operator()(T value) const {
+        *value_ = std::move(value);
+        server_post(&resume_coroutine, coroutine_.address());
+    }
+
+private:
+    std::optional<T>* value_;
+    std::coroutine_handle<> coroutine_;
+};
+
+// Start an upstream call: `start` receives a Completion<T> and arranges for it
+// to be called with the result
+template <typename T, typename Start>
+UpstreamAwaiter<T, Start> upstream(Start start) {
+    return UpstreamAwaiter<T, Start>(std::move(start));
+}
+
+} // namespace server
+
+// Export handle_message_from_client running `coroutine` on every request
+#define SERVER_COROUTINE_HANDLER(coroutine)                                                                    \
+    extern "C" EXPORT_SYMBOL int handle_message_from_client(const char* data, int data_len, char** send_data, \
+                                                            int* send_data_len, const SocketInfo* si) {       \
+        (void)send_data;                                                                                       \
+        (void)send_data_len;                                                                                   \
+        coroutine(server::Request(server_request_handle(), data, data_len, si));                              \
+        return HANDLER_DEFERRED;                                                                               \
+    }
+
+#endif // SERVER_COROUTINE_H